@@ -0,0 +1,117 @@
+# UnippDiscoverTests.cmake
+#
+# Registers every test of a unipp test binary with CTest, so that ctest can
+# run, filter, time out and parallelise (ctest -j) them one by one.
+#
+#   list(APPEND CMAKE_MODULE_PATH "${unipp_SOURCE_DIR}/cmake")
+#   include(UnippDiscoverTests)
+#
+#   add_executable(tests tests.cpp)
+#   unipp_discover_tests(tests
+#       [TEST_PREFIX prefix]          # Prepended to every CTest name
+#       [EXTRA_ARGS args...]          # Passed to the binary when listing and running
+#       [WORKING_DIRECTORY dir]       # Where the tests run (default: the build directory)
+#       [PROPERTIES name value...])   # Extra properties for every test
+#
+# Tests are discovered when ctest runs, by running the binary with --list,
+# so they are always in sync with the binary. Each test runs as
+# "binary --filter=<suite>/<test> --cache=" (the shared history cache would
+# race between parallel processes, pass --cache=<path> in EXTRA_ARGS to
+# override), its tags become LABELS and its time limit, if any, TIMEOUT.
+# Needs CMake 3.19 (string(JSON)).
+
+if(DEFINED _UNIPP_DISCOVER_EXECUTABLE)
+      # Included by ctest, through the file unipp_discover_tests generated
+      if(NOT EXISTS "${_UNIPP_DISCOVER_EXECUTABLE}")
+            add_test("${_UNIPP_DISCOVER_TARGET}_NOT_BUILT" "${_UNIPP_DISCOVER_EXECUTABLE}")
+            return()
+      endif()
+
+      execute_process(
+            COMMAND "${_UNIPP_DISCOVER_EXECUTABLE}" --list ${_UNIPP_DISCOVER_EXTRA_ARGS}
+            WORKING_DIRECTORY "${_UNIPP_DISCOVER_WORKING_DIRECTORY}"
+            OUTPUT_VARIABLE listing
+            RESULT_VARIABLE result)
+      if(NOT result EQUAL 0)
+            message(WARNING "Could not list the tests of ${_UNIPP_DISCOVER_EXECUTABLE}: ${result}")
+            add_test("${_UNIPP_DISCOVER_TARGET}_NOT_LISTED" "${_UNIPP_DISCOVER_EXECUTABLE}" --list ${_UNIPP_DISCOVER_EXTRA_ARGS})
+            return()
+      endif()
+
+      string(JSON suites LENGTH "${listing}" suites)
+      if(suites GREATER 0)
+            math(EXPR last_suite "${suites} - 1")
+            foreach(suite RANGE ${last_suite})
+                  string(JSON tests LENGTH "${listing}" suites ${suite} tests)
+                  if(tests EQUAL 0)
+                        continue()
+                  endif()
+                  math(EXPR last_test "${tests} - 1")
+                  foreach(test RANGE ${last_test})
+                        string(JSON full_name GET "${listing}" suites ${suite} tests ${test} full_name)
+                        string(JSON timeout_ms GET "${listing}" suites ${suite} tests ${test} timeout_ms)
+                        string(JSON tag_count LENGTH "${listing}" suites ${suite} tests ${test} tags)
+
+                        # --filter takes comma separated globs, ? stands in for the characters it treats specially
+                        string(REGEX REPLACE "[*?,]" "?" filter "${full_name}")
+                        set(name "${_UNIPP_DISCOVER_TEST_PREFIX}${full_name}")
+                        add_test("${name}" "${_UNIPP_DISCOVER_EXECUTABLE}" "--filter=${filter}" --cache= ${_UNIPP_DISCOVER_EXTRA_ARGS})
+                        set_tests_properties("${name}" PROPERTIES WORKING_DIRECTORY "${_UNIPP_DISCOVER_WORKING_DIRECTORY}")
+
+                        if(tag_count GREATER 0)
+                              set(labels "")
+                              math(EXPR last_tag "${tag_count} - 1")
+                              foreach(tag RANGE ${last_tag})
+                                    string(JSON label GET "${listing}" suites ${suite} tests ${test} tags ${tag})
+                                    list(APPEND labels "${label}")
+                              endforeach()
+                              set_tests_properties("${name}" PROPERTIES LABELS "${labels}")
+                        endif()
+                        if(timeout_ms GREATER 0)
+                              # A second of slack, so the runner's own timeout report wins
+                              math(EXPR timeout "(${timeout_ms} + 999) / 1000 + 1")
+                              set_tests_properties("${name}" PROPERTIES TIMEOUT ${timeout})
+                        endif()
+                        if(_UNIPP_DISCOVER_PROPERTIES)
+                              set_tests_properties("${name}" PROPERTIES ${_UNIPP_DISCOVER_PROPERTIES})
+                        endif()
+                  endforeach()
+            endforeach()
+      endif()
+      return()
+endif()
+
+set(_UNIPP_DISCOVER_SCRIPT "${CMAKE_CURRENT_LIST_FILE}")
+
+function(unipp_discover_tests target)
+      cmake_parse_arguments(PARSE_ARGV 1 arg "" "TEST_PREFIX;WORKING_DIRECTORY" "EXTRA_ARGS;PROPERTIES")
+      if(NOT arg_WORKING_DIRECTORY)
+            set(arg_WORKING_DIRECTORY "${CMAKE_CURRENT_BINARY_DIR}")
+      endif()
+
+      get_property(multi_config GLOBAL PROPERTY GENERATOR_IS_MULTI_CONFIG)
+      set(base "${CMAKE_CURRENT_BINARY_DIR}/${target}_unipp_tests")
+      set(content
+"set(_UNIPP_DISCOVER_TARGET [==[${target}]==])
+set(_UNIPP_DISCOVER_EXECUTABLE [==[$<TARGET_FILE:${target}>]==])
+set(_UNIPP_DISCOVER_EXTRA_ARGS [==[${arg_EXTRA_ARGS}]==])
+set(_UNIPP_DISCOVER_TEST_PREFIX [==[${arg_TEST_PREFIX}]==])
+set(_UNIPP_DISCOVER_WORKING_DIRECTORY [==[${arg_WORKING_DIRECTORY}]==])
+set(_UNIPP_DISCOVER_PROPERTIES [==[${arg_PROPERTIES}]==])
+include([==[${_UNIPP_DISCOVER_SCRIPT}]==])
+")
+
+      if(multi_config)
+            file(GENERATE OUTPUT "${base}-$<CONFIG>.cmake" CONTENT "${content}")
+            file(WRITE "${base}.cmake"
+"if(EXISTS \"${base}-\${CTEST_CONFIGURATION_TYPE}.cmake\")
+      include(\"${base}-\${CTEST_CONFIGURATION_TYPE}.cmake\")
+else()
+      add_test([==[${target}_NOT_BUILT]==] [==[${target}_NOT_BUILT]==])
+endif()
+")
+      else()
+            file(GENERATE OUTPUT "${base}.cmake" CONTENT "${content}")
+      endif()
+      set_property(DIRECTORY APPEND PROPERTY TEST_INCLUDE_FILES "${base}.cmake")
+endfunction()
@@ -0,0 +1,43 @@
+// Async tests need C++20: g++ -std=c++20 async_tests.cpp
+#include "unipp.hpp"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+unipp::Task Send(int fd, std::string message)
+{
+      co_await unipp::Writable(fd);
+      ::write(fd, message.data(), message.size());
+}
+
+unipp::Task RoundTrip(int id)
+{
+      int fds[2];
+      ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+
+      // Pretend the server takes a while, the other tests run meanwhile
+      co_await unipp::Sleep(MILLISECONDS(100));
+      co_await Send(fds[0], "ping " + std::to_string(id));
+
+      co_await unipp::Readable(fds[1]);
+      char buffer[64];
+      const ssize_t size = ::read(fds[1], buffer, sizeof(buffer));
+      ::close(fds[0]);
+      ::close(fds[1]);
+
+      CO_ASSERT_EQUAL(std::string(buffer, size > 0 ? size : 0), "ping " + std::to_string(id), "Expected the message back");
+}
+
+int main(int argc, char** argv)
+{
+      CONFIGURE(argc, argv);
+
+      // A thousand tests waiting 100 ms each take about 100 ms in total
+      unipp::TestSuite suite("Sockets", "Round trips over socket pairs");
+      for (int i = 0; i < 1000; i++) {
+            suite.AddTests(TEST("Round trip " + std::to_string(i), "Sends a message and reads it back",
+                  [i]() -> unipp::Task { co_await RoundTrip(i); }));
+      }
+
+      return RUN(suite);
+}
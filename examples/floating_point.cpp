@@ -0,0 +1,33 @@
+#include "unipp.hpp"
+
+#include <cmath>
+
+void scalar_test()
+{
+      ASSERT_NEAR(0.1 + 0.2, 0.3, 1e-12, "Expected 0.1 + 0.2 to be close to 0.3");             // This will pass
+      ASSERT_NEAR(0.1 + 0.2, 0.3, unipp::Tolerance::Ulps(1), "Expected at most 1 ulp apart"); // This will pass
+      ASSERT_NEAR(std::sqrt(2.0), 1.4142, 1e-9, "Expected sqrt(2) to be 1.4142");              // This will fail
+}
+
+void array_test()
+{
+      std::vector<double> output(1000000), expected(1000000);
+      for (std::size_t i = 0; i < output.size(); i++) {
+            output[i] = std::sin(i * 1e-3);
+            expected[i] = std::sin(i * 1e-3);
+      }
+      output[123456] += 1e-6;
+
+      // This will fail, reporting the maximum error and its index
+      ASSERT_ARRAY_NEAR(output, expected, unipp::Tolerance::Relative(1e-9), "Expected the kernel output to match");
+}
+
+int main(void)
+{
+      RUN(
+            SUITE("Floating point", "Approximate comparisons",
+                  TEST("Scalars", "Absolute and ULP tolerances", scalar_test),
+                  TEST("Arrays", "Bulk relative tolerance", array_test)
+            )
+      );
+}
@@ -0,0 +1,9 @@
+// Runs test modules, rerunning each one whenever it is rebuilt:
+//   g++ -std=c++17 module_runner.cpp -o module_runner
+//   ./module_runner --watch ./test_module.so
+#include "unipp.hpp"
+
+int main(int argc, char** argv)
+{
+      return RUN_MODULES(argc, argv);
+}
@@ -0,0 +1,34 @@
+#include "unipp.hpp"
+
+#include <algorithm>
+
+// A buggy absolute value, wrong for large negative numbers
+int absolute(int x)
+{
+      return x < -1000 ? x : (x < 0 ? -x : x);
+}
+
+int main(int argc, char** argv)
+{
+      CONFIGURE(argc, argv);
+
+      return RUN(
+            SUITE("Properties", "Property based tests",
+                  // This will pass
+                  PROPERTY("Reverse", "Reversing twice gives back the original",
+                        [](const std::vector<int>& values) {
+                              std::vector<int> copy = values;
+                              std::reverse(copy.begin(), copy.end());
+                              std::reverse(copy.begin(), copy.end());
+                              return copy == values;
+                        },
+                        unipp::gen::VectorOf(unipp::gen::Int(-100, 100))
+                  ),
+                  // This will fail, shrinking the input down to -1001
+                  PROPERTY_CASES("Absolute", "Absolute values are never negative", 10000,
+                        [](int x) { return absolute(x) >= 0; },
+                        unipp::gen::Int(-100000, 100000)
+                  )
+            )
+      );
+}
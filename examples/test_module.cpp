@@ -0,0 +1,26 @@
+// A test module, built as a shared object and run by module_runner.cpp:
+//   g++ -std=c++17 -fPIC -shared test_module.cpp -o test_module.so
+#include "unipp.hpp"
+
+int Add(int a, int b)
+{
+      return a + b;
+}
+
+void test_add()
+{
+      ASSERT_EQUAL(Add(2, 2), 4, "Expected 2 + 2 to be 4");
+}
+
+void test_negative()
+{
+      ASSERT_EQUAL(Add(-2, 1), -1, "Expected -2 + 1 to be -1");
+}
+
+// Exports the module's tests, instead of a main function
+UNIPP_MODULE(
+      SUITE("Math module", "Tests loaded with dlopen",
+            TEST("Add", "Adds two numbers", test_add),
+            TEST("Negative", "Adds a negative number", test_negative)
+      )
+)
@@ -0,0 +1,388 @@
+// unipp-run: runs the tests of many unipp test binaries at once.
+//
+//   g++ -std=c++17 -I../unipp unipp-run.cpp -o unipp-run
+//   ./unipp-run [--jobs=<n>] [--pattern=<glob>] [--junit=<path>] <binaries or directories>... [-- <test options>]
+//
+// Directories are searched (not recursively) for executables whose name
+// matches --pattern ("*test*" by default). Every binary lists its tests
+// with --list, then the tests are split into shards (--shard=<i>/<n>), so
+// that big binaries are spread over several processes, and up to --jobs
+// shards (one per core by default) run at once. Each shard's output is
+// printed whole when it finishes. Shards publish their results to a
+// shared memory channel (--results=<fd>) rather than reporting them as
+// text, and the results of all of them go into one summary and one
+// JUnit report, a testsuite per shard written as soon as it finishes.
+// A shard that publishes nothing (a binary that could not be listed and
+// ran whole) gets one result from its exit status. Options after -- are
+// passed on to every binary. Shards run with --cache= : their test
+// history would race on one file, so --incremental, --quarantine and
+// flakiness rates need the binaries run on their own.
+#include "unipp.hpp"
+
+#if !defined(UNIPP_HAS_FORK)
+#error unipp-run needs fork and exec
+#endif // UNIPP_HAS_FORK
+
+namespace
+{
+      struct Binary
+      {
+            explicit Binary(std::string path) : path(std::move(path)) {}
+
+            std::string path;
+            std::size_t tests = 0;
+            std::size_t shards = 1;
+      };
+
+      struct Shard
+      {
+            Binary* binary;
+            std::size_t index;
+            std::unique_ptr<unipp::detail::ResultChannel> channel;
+            pid_t pid = -1;
+            int output = -1;
+            std::string text;
+            int status = 0;
+            // Until the shard is done, its results are then reported and dropped
+            std::vector<unipp::TestResult> results;
+      };
+
+      std::string Name(const std::string& path)
+      {
+            return std::filesystem::path(path).filename().string();
+      }
+
+      bool IsExecutable(const std::filesystem::path& path)
+      {
+            std::error_code error;
+            return std::filesystem::is_regular_file(path, error) && access(path.c_str(), X_OK) == 0;
+      }
+
+      /** Runs a command and returns its stdout, empty if it failed */
+      std::string Capture(const std::vector<std::string>& command)
+      {
+            int pipes[2];
+            if (pipe(pipes) != 0) {
+                  return "";
+            }
+            const pid_t child = fork();
+            if (child == 0) {
+                  dup2(pipes[1], STDOUT_FILENO);
+                  close(pipes[0]);
+                  close(pipes[1]);
+                  std::vector<char*> argv;
+                  for (const auto& argument : command) {
+                        argv.push_back(const_cast<char*>(argument.c_str()));
+                  }
+                  argv.push_back(nullptr);
+                  execv(argv[0], argv.data());
+                  _exit(127);
+            }
+            close(pipes[1]);
+            std::string output;
+            char buffer[4096];
+            ssize_t size;
+            while ((size = read(pipes[0], buffer, sizeof(buffer))) != 0) {
+                  if (size > 0) {
+                        output.append(buffer, size);
+                  }
+                  else if (errno != EINTR) {
+                        break;
+                  }
+            }
+            close(pipes[0]);
+            int status = 0;
+            while (waitpid(child, &status, 0) < 0 && errno == EINTR) {
+            }
+            return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? output : "";
+      }
+
+      /** Counts the tests in a --list listing, one "full_name" per test */
+      std::size_t CountTests(const std::string& listing)
+      {
+            std::size_t count = 0;
+            for (std::size_t at = listing.find("\"full_name\""); at != std::string::npos; at = listing.find("\"full_name\"", at + 1)) {
+                  count++;
+            }
+            return count;
+      }
+
+      std::string Label(const Shard& shard)
+      {
+            std::string label = shard.binary->path;
+            if (shard.binary->shards > 1) {
+                  label += " (shard " + std::to_string(shard.index + 1) + " of " + std::to_string(shard.binary->shards) + ")";
+            }
+            return label;
+      }
+
+      /** Starts a shard, false if it could not be */
+      bool Start(Shard& shard, const std::vector<std::string>& options)
+      {
+            std::vector<std::string> command{ shard.binary->path };
+            if (shard.binary->shards > 1) {
+                  command.push_back("--shard=" + std::to_string(shard.index) + "/" + std::to_string(shard.binary->shards));
+            }
+            try {
+                  shard.channel = std::make_unique<unipp::detail::ResultChannel>();
+            }
+            catch (const std::exception& e) {
+                  std::cerr << "[!] Could not start " << Label(shard) << ": " << e.what() << std::endl;
+                  return false;
+            }
+            int pipes[2];
+            if (pipe(pipes) != 0) {
+                  std::cerr << "[!] Could not start " << Label(shard) << ": " << std::strerror(errno) << std::endl;
+                  return false;
+            }
+            command.push_back("--results=" + std::to_string(shard.channel->Descriptor()));
+            command.insert(command.end(), options.begin(), options.end());
+            // Last, so it wins: shards running at once would all load and save the same history
+            command.push_back("--cache=");
+
+            shard.pid = fork();
+            if (shard.pid < 0) {
+                  std::cerr << "[!] Could not start " << Label(shard) << ": " << std::strerror(errno) << std::endl;
+                  close(pipes[0]);
+                  close(pipes[1]);
+                  return false;
+            }
+            if (shard.pid == 0) {
+                  dup2(pipes[1], STDOUT_FILENO);
+                  dup2(pipes[1], STDERR_FILENO);
+                  close(pipes[0]);
+                  close(pipes[1]);
+                  fcntl(shard.channel->Descriptor(), F_SETFD, 0);
+                  std::vector<char*> argv;
+                  for (const auto& argument : command) {
+                        argv.push_back(const_cast<char*>(argument.c_str()));
+                  }
+                  argv.push_back(nullptr);
+                  execv(argv[0], argv.data());
+                  _exit(127);
+            }
+            close(pipes[1]);
+            shard.output = pipes[0];
+            return true;
+      }
+
+      void Collect(Shard& shard)
+      {
+            shard.channel->Drain([&shard](unipp::TestResult result) { shard.results.push_back(std::move(result)); });
+      }
+
+      /**
+       * Gives a finished shard a result of its own when its tests cannot
+       * tell what happened: when it crashed, or when it published nothing
+       * at all (a binary that could not be listed, or not a unipp binary),
+       * in which case its exit status and output are all there is.
+       */
+      void Conclude(Shard& shard)
+      {
+            const bool crashed = !WIFEXITED(shard.status) || WEXITSTATUS(shard.status) > 1;
+            if (!crashed && !shard.results.empty()) {
+                  return;
+            }
+            unipp::TestResult result;
+            result.suite = Name(shard.binary->path);
+            result.name = "[shard " + std::to_string(shard.index + 1) + "]";
+            if (WIFEXITED(shard.status) && WEXITSTATUS(shard.status) == 0) {
+                  result.status = unipp::TestStatus::Passed;
+            }
+            else {
+                  result.status = unipp::TestStatus::Failed;
+                  result.message = Label(shard) + " " + unipp::detail::DescribeStatus(shard.status);
+            }
+            if (shard.results.empty()) {
+                  result.output = shard.text;
+            }
+            shard.results.push_back(result);
+      }
+
+}
+
+int main(int argc, char** argv)
+{
+      unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+      std::string pattern = "*test*";
+      std::string junit;
+      std::vector<std::string> paths;
+      std::vector<std::string> options;
+      for (int i = 1; i < argc; i++) {
+            const std::string argument = argv[i];
+            if (argument == "--") {
+                  options.assign(argv + i + 1, argv + argc);
+                  break;
+            }
+            if (argument.compare(0, 7, "--jobs=") == 0) {
+                  jobs = std::max(1u, static_cast<unsigned>(std::stoul(argument.substr(7))));
+            }
+            else if (argument.compare(0, 10, "--pattern=") == 0) {
+                  pattern = argument.substr(10);
+            }
+            else if (argument.compare(0, 8, "--junit=") == 0) {
+                  junit = argument.substr(8);
+            }
+            else {
+                  paths.push_back(argument);
+            }
+      }
+
+      for (const auto& option : options) {
+            if (option.compare(0, 8, "--cache=") == 0) {
+                  std::cerr << "[!] Ignoring " << option << ", shards keep no test history" << std::endl;
+            }
+      }
+
+      // Discovery
+      std::vector<Binary> binaries;
+      for (const auto& path : paths) {
+            std::error_code error;
+            if (std::filesystem::is_directory(path, error)) {
+                  std::vector<std::string> found;
+                  for (const auto& entry : std::filesystem::directory_iterator(path, error)) {
+                        if (IsExecutable(entry.path()) && unipp::detail::GlobMatch(pattern.c_str(), entry.path().filename().c_str())) {
+                              found.push_back(entry.path().string());
+                        }
+                  }
+                  std::sort(found.begin(), found.end());
+                  for (const auto& binary : found) {
+                        binaries.emplace_back(binary);
+                  }
+            }
+            else if (IsExecutable(path)) {
+                  binaries.emplace_back(std::filesystem::path(path).is_relative() && path.find('/') == std::string::npos ? "./" + path : path);
+            }
+            else {
+                  std::cerr << "[!] Not a test binary or directory: " << path << std::endl;
+            }
+      }
+
+      std::size_t total = 0;
+      for (auto& binary : binaries) {
+            std::vector<std::string> command{ binary.path, "--list" };
+            command.insert(command.end(), options.begin(), options.end());
+            const std::string listing = Capture(command);
+            if (listing.find("\"suites\"") == std::string::npos) {
+                  std::cerr << "[!] Could not list the tests of " << binary.path << ", running it whole" << std::endl;
+                  binary.tests = 1;
+            }
+            else {
+                  binary.tests = CountTests(listing);
+            }
+            total += binary.tests;
+      }
+      binaries.erase(std::remove_if(binaries.begin(), binaries.end(), [](const Binary& binary) { return binary.tests == 0; }), binaries.end());
+      if (binaries.empty()) {
+            std::cerr << "[!] No tests found" << std::endl;
+            return 1;
+      }
+      // Opened before the run, so that a report on stdout moves the progress to stderr
+      std::unique_ptr<unipp::detail::JUnitReporter> merged;
+      if (!junit.empty()) {
+            merged = std::make_unique<unipp::detail::JUnitReporter>(junit, "");
+            merged->Begin();
+      }
+
+      // A binary gets shards in proportion to its share of the tests, so the biggest one does not bound the run
+      std::vector<Shard> shards;
+      for (auto& binary : binaries) {
+            binary.shards = std::max<std::size_t>(1, std::min(binary.tests, (binary.tests * jobs + total - 1) / total));
+            for (std::size_t i = 0; i < binary.shards; i++) {
+                  shards.push_back({ &binary, i, nullptr, -1, -1, "", 0, {} });
+            }
+      }
+      // Biggest shards first, the small ones fill in the gaps at the end
+      std::stable_sort(shards.begin(), shards.end(), [](const Shard& a, const Shard& b) {
+            return a.binary->tests / a.binary->shards > b.binary->tests / b.binary->shards;
+      });
+
+      std::cout << "[UNIPP-RUN] " << total << " tests in " << binaries.size() << " binaries, "
+                << shards.size() << " shards on " << jobs << " jobs" << std::endl;
+
+      // Run the shards, collecting each one's output and results as they come. A shard
+      // waits for the channel to be drained when it fills up, so it is drained often
+      std::size_t next = 0;
+      std::vector<Shard*> running;
+      bool passed = true;
+      std::size_t total_results = 0;
+      std::size_t counts[5] = { 0, 0, 0, 0, 0 };
+      while (next < shards.size() || !running.empty()) {
+            while (next < shards.size() && running.size() < jobs) {
+                  if (Start(shards[next], options)) {
+                        running.push_back(&shards[next]);
+                  }
+                  else {
+                        passed = false;
+                  }
+                  next++;
+            }
+
+            std::vector<pollfd> events;
+            for (const Shard* shard : running) {
+                  events.push_back({ shard->output, POLLIN, 0 });
+            }
+            const int ready = poll(events.data(), events.size(), 10);
+            for (Shard* shard : running) {
+                  Collect(*shard);
+            }
+            if (ready <= 0) {
+                  continue;
+            }
+            for (std::size_t i = 0; i < events.size(); i++) {
+                  if (!events[i].revents) {
+                        continue;
+                  }
+                  Shard& shard = *running[i];
+                  char buffer[4096];
+                  const ssize_t size = read(shard.output, buffer, sizeof(buffer));
+                  if (size > 0) {
+                        shard.text.append(buffer, size);
+                        continue;
+                  }
+                  if (size < 0 && errno == EINTR) {
+                        continue;
+                  }
+
+                  close(shard.output);
+                  shard.output = -1;
+                  while (waitpid(shard.pid, &shard.status, 0) < 0 && errno == EINTR) {
+                  }
+                  Collect(shard);
+                  shard.channel.reset();
+                  passed &= WIFEXITED(shard.status) && WEXITSTATUS(shard.status) == 0;
+                  std::cout << "[RUN] " << Label(shard) << std::endl << shard.text;
+                  if (!WIFEXITED(shard.status) || WEXITSTATUS(shard.status) > 1) {
+                        std::cout << "[!] " << Label(shard) << " " << unipp::detail::DescribeStatus(shard.status) << std::endl;
+                  }
+                  std::cout << std::endl << std::flush;
+                  Conclude(shard);
+
+                  // Into the summary and the report, a testsuite per shard, and then forgotten
+                  if (merged) {
+                        merged->Suite(shard.binary->shards > 1 ? Name(shard.binary->path) + " (shard " + std::to_string(shard.index + 1)
+                                                                    + " of " + std::to_string(shard.binary->shards) + ")"
+                                                               : Name(shard.binary->path));
+                  }
+                  for (const auto& result : shard.results) {
+                        counts[static_cast<int>(result.status)]++;
+                        total_results++;
+                        if (merged) {
+                              merged->Report(result);
+                        }
+                  }
+                  std::vector<unipp::TestResult>().swap(shard.results);
+                  shard.text.clear();
+                  shard.text.shrink_to_fit();
+            }
+            running.erase(std::remove_if(running.begin(), running.end(), [](const Shard* shard) { return shard->output < 0; }), running.end());
+      }
+
+      if (merged) {
+            merged->End();
+      }
+
+      std::cout << "[SUMMARY] " << total_results << " tests: " << counts[0] << " passed, " << counts[1] << " failed, "
+                << counts[2] << " timed out, " << counts[3] << " cached, " << counts[4] << " flaky" << std::endl;
+      return passed ? 0 : 1;
+}
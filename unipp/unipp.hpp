@@ -13,41 +13,89 @@
  */
 
 // TODO: Add different logging levels for failed tests
-// TODO: Maybe add support for custom test suites with custom setup and teardown functions
 
 #ifndef UNIPP_TEST_FRAMEWORK_HPP
 #define UNIPP_TEST_FRAMEWORK_HPP
 
 
-/** C++ headers */
-#include <iostream>
-#include <string>
-#include <vector>
-#include <functional>
-#include <stdexcept>
-#include <memory>
+/**
+ * Build modes. By default unipp is header-only: every source file that
+ * includes it compiles the whole framework. Large test suites can split it:
+ *
+ *   UNIPP_LIGHT           Defined before including unipp.hpp in test sources,
+ *                         which then only get the assertion macros, TEST_CASE
+ *                         and the few declarations behind them.
+ *   UNIPP_IMPLEMENTATION  Defined in the one source file that runs the
+ *                         tests, which compiles everything else once,
+ *                         including what the light sources link against.
+ */
+
+/** C++ headers every test source needs */
+#include <exception>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
 
 /** MACROS */
 #define UNIPP_TEST_FRAMEWORK_VERSION "0.1.0"
 
-#if defined(__APPLE__)
-#define inline __attribute__((always_inline))
-#endif // __APPLE__
-
 /** Macros for creating and running tests */
-#define TEST(name, description, testfunction) unipp::UnitTest(name, description, testfunction)
+#define TEST(name, description, testfunction) unipp::UnitTest(name, description, testfunction).Source(__FILE__)
 #define SUITE(name, description, ...) unipp::TestSuite(name, description, __VA_ARGS__)
+#define PROPERTY(name, description, property, ...) unipp::Property(name, description, 0, property, __VA_ARGS__).Source(__FILE__)
+#define PROPERTY_CASES(name, description, cases, property, ...) unipp::Property(name, description, cases, property, __VA_ARGS__).Source(__FILE__)
+#define FUZZ(name, description, target) unipp::Fuzz(name, description, target)
+#define TABLE(name, description, path, ...) unipp::Table(name, description, path, unipp::TableFormat(), __VA_ARGS__).Source(__FILE__)
+#define TABLE_OF(name, description, path, format, ...) unipp::Table(name, description, path, format, __VA_ARGS__).Source(__FILE__)
+#define PARAMETERIZED(name, description, values, ...) unipp::Parameterized(name, description, values, __VA_ARGS__).Source(__FILE__)
+#define TYPED_TEST(name, description, ...) unipp::Typed(name, description, __VA_ARGS__)
+#define CONSTEXPR_TEST(name, description, ...)                                                                  \
+      unipp::ConstexprTest(name, description, []() {                                                              \
+            static constexpr auto unipp_constexpr_test = __VA_ARGS__;                                           \
+            static_assert(unipp::detail::ConstexprPasses(unipp_constexpr_test), "CONSTEXPR_TEST failed: " name); \
+            return unipp_constexpr_test;                                                                       \
+      }())
+#define INTERLEAVINGS(name, description, ...) unipp::Interleavings(name, description, __VA_ARGS__)
 #define RUN(...) unipp::TestRunner::RunAll(__VA_ARGS__)
+#define CONFIGURE(argc, argv) unipp::TestRunner::Configure(argc, argv)
+
+/**
+ * Tests defined at namespace scope in any source file, which register
+ * themselves before main and are run by RUN along with its arguments:
+ *
+ *   TEST_CASE("Math", "Add", "Adds two numbers") { ASSERT_EQUAL(1 + 1, 2, "sum"); }
+ *
+ * An empty suite name leaves the test outside of any suite.
+ */
+#define TEST_CASE(suite, name, description) UNIPP_TEST_CASE(UNIPP_CONCAT(unipp_test_case_, __COUNTER__), suite, name, description)
+#define UNIPP_TEST_CASE(function, suite, name, description)                                                     \
+      static void function();                                                                                     \
+      [[maybe_unused]] static const bool UNIPP_CONCAT(function, _registered) =                                    \
+            unipp::detail::Register(suite, name, description, function, __FILE__);                                \
+      static void function()
+#define UNIPP_CONCAT(a, b) UNIPP_CONCAT_EXPANDED(a, b)
+#define UNIPP_CONCAT_EXPANDED(a, b) a##b
+
+/** Test modules: shared objects loaded by RUN_MODULES, see unipp::RunModules */
+#define UNIPP_MODULE(...)                                                                                   \
+      extern "C" __attribute__((visibility("default"))) int unipp_module_main(int argc, char** argv)     \
+      {                                                                                                 \
+            CONFIGURE(argc, argv);                                                                      \
+            return RUN(__VA_ARGS__);                                                                    \
+      }
+#define RUN_MODULES(argc, argv) unipp::RunModules(argc, argv)
 
 /** Macros for benchmarking */
 #define BENCHMARK(function, iterations) unipp::Benchmark(function, iterations)
 #define SECONDS_TO_MILLISECONDS(seconds_count) std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::seconds(seconds_count)).count()
 #define MILLISECONDS(milliseconds_count) std::chrono::milliseconds(milliseconds_count)
+#define SECONDS(seconds_count) std::chrono::seconds(seconds_count)
 
 /** Macros for assertions */
-#define PASS_MESSAGE() std::cout << "      [√] PASSED" << std::endl << std::endl
-#define FAIL_MESSAGE() std::cout << "      [X] FAILED: " << e.what() << std::endl
-#define WARN_MESSAGE() std::cout << "      [!] WARNING: " << e.what() << std::endl
+#define PASS_MESSAGE() unipp::detail::Pass()
+#define FAIL_MESSAGE() unipp::detail::Fail(e.what())
+#define WARN_MESSAGE() unipp::detail::Warn(e.what())
 
 #define BEGIN_ASSERT try {
 #define END_ASSERT                              \
@@ -83,7 +131,7 @@
 #define ASSERT_FALSE(a, msg) BASE_ASSERT(unipp::False(a, msg);)
 #define ASSERT_NULL(a, msg) BASE_ASSERT(unipp::Null(a, msg);)
 #define ASSERT_NOT_NULL(a, msg) BASE_ASSERT(unipp::NotNull(a, msg);)
-#define EXPECT(condition, message) BASE_BASE_EXPECT(unipp::Assert(condition, message);)
+#define EXPECT(condition, message) BASE_EXPECT(unipp::Assert(condition, message);)
 #define EXPECT_EQUAL(a, b, msg) BASE_EXPECT(unipp::Equal(a, b, msg);)
 #define EXPECT_NOT_EQUAL(a, b, msg) BASE_EXPECT(unipp::NotEqual(a, b, msg);)
 #define EXPECT_GREATER(a, b, msg) BASE_EXPECT(unipp::Greater(a, b, msg);)
@@ -95,275 +143,8069 @@
 #define EXPECT_NULL(a, msg) BASE_EXPECT(unipp::Null(a, msg);)
 #define EXPECT_NOT_NULL(a, msg) BASE_EXPECT(unipp::NotNull(a, msg);)
 
+/** Approximate floating point comparisons, see unipp::Tolerance */
+#define ASSERT_NEAR(a, b, tolerance, msg) BASE_ASSERT(unipp::Near(a, b, tolerance, msg);)
+#define ASSERT_ARRAY_NEAR(a, b, tolerance, msg) BASE_ASSERT(unipp::ArrayNear(a, b, tolerance, msg);)
+#define ASSERT_ARRAY_NEAR_N(a, b, size, tolerance, msg) BASE_ASSERT(unipp::ArrayNear(a, b, size, tolerance, msg);)
+#define EXPECT_NEAR(a, b, tolerance, msg) BASE_EXPECT(unipp::Near(a, b, tolerance, msg);)
+#define EXPECT_ARRAY_NEAR(a, b, tolerance, msg) BASE_EXPECT(unipp::ArrayNear(a, b, tolerance, msg);)
+#define EXPECT_ARRAY_NEAR_N(a, b, size, tolerance, msg) BASE_EXPECT(unipp::ArrayNear(a, b, size, tolerance, msg);)
 
-namespace unipp
-{
-      /** Type definitions */
-      typedef std::function<void()> TestFunction;
-
-      /** Structs */
-      struct BenchmarkResult {
-            std::chrono::milliseconds total;
-            std::chrono::milliseconds average;
-
-            BenchmarkResult(std::chrono::milliseconds total, std::chrono::milliseconds average)
-                  : total(total), average(average) {}
-
-            void Show()
-            {
-                  std::cout << "   [BENCHMARK] Total time: " << total.count() << "ms" << std::endl;
-                  std::cout << "   [BENCHMARK] Average time: " << average.count() << "ms" << std::endl;
-            }
-      };
-
-      /**
-       * @brief Defines a unit test
-       */
-      struct UnitTest
-      {
-            std::string name;         
-            std::string description;
-            TestFunction test;
-
-            UnitTest(std::string name, std::string description, TestFunction test)
-                  : name(name), description(description), test(test) {}
+/** Assertions for async tests, which must co_return rather than return */
+#define END_CO_ASSERT                           \
+      PASS_MESSAGE();                           \
+      }                                         \
+      catch (const std::exception& e)           \
+      {                                         \
+            FAIL_MESSAGE();                     \
+            co_return;                          \
+      }                                         \
 
-            /**
-             * @brief Runs the test
-             */
-            void Run()
-            {
-                  std::cout << "   [TEST] Running test: " << name << std::endl;
-                  std::cout << "   [+] Description: " << description << std::endl;
-                  test();
-            }
-      };
+#define BASE_CO_ASSERT(...) BEGIN_ASSERT __VA_ARGS__ END_CO_ASSERT
 
+#define CO_ASSERT(condition, message) BASE_CO_ASSERT(unipp::Assert(condition, message);)
+#define CO_ASSERT_EQUAL(a, b, msg) BASE_CO_ASSERT(unipp::Equal(a, b, msg);)
+#define CO_ASSERT_NOT_EQUAL(a, b, msg) BASE_CO_ASSERT(unipp::NotEqual(a, b, msg);)
+#define CO_ASSERT_GREATER(a, b, msg) BASE_CO_ASSERT(unipp::Greater(a, b, msg);)
+#define CO_ASSERT_GREATER_EQUAL(a, b, msg) BASE_CO_ASSERT(unipp::GreaterEqual(a, b, msg);)
+#define CO_ASSERT_LESS(a, b, msg) BASE_CO_ASSERT(unipp::Less(a, b, msg);)
+#define CO_ASSERT_LESS_EQUAL(a, b, msg) BASE_CO_ASSERT(unipp::LessEqual(a, b, msg);)
+#define CO_ASSERT_TRUE(a, msg) BASE_CO_ASSERT(unipp::True(a, msg);)
+#define CO_ASSERT_FALSE(a, msg) BASE_CO_ASSERT(unipp::False(a, msg);)
+#define CO_ASSERT_NULL(a, msg) BASE_CO_ASSERT(unipp::Null(a, msg);)
+#define CO_ASSERT_NOT_NULL(a, msg) BASE_CO_ASSERT(unipp::NotNull(a, msg);)
+#define CO_ASSERT_NEAR(a, b, tolerance, msg) BASE_CO_ASSERT(unipp::Near(a, b, tolerance, msg);)
 
-      /** Classes */
-      class TestSuite
-      {
-      public:
-            /**
-             * @brief Construct a new Test Suite object
-             *
-             *        SUITE("My Suite", "This is a suite description", PER_TEST,
-             *              TEST("My Test", "This is a test description", []() { ... }),
-             *              TEST("My Test 2", "This is a test description", []() { ... }),
-             *              TEST("My Test 3", "This is a test description", []() { ... })
-             *        );
-             *
-             * @tparam Tests
-             * @param name
-             * @param description
-             * @param tests
-             */
-            template<typename... Tests>
-            TestSuite(std::string name, std::string description, Tests... tests)
-                      : name_(name), description_(description)
-            {
-                  AddTests(tests...);
-            }
+/** Checks inside CONSTEXPR_TEST bodies: compile errors when evaluated at compile time, failures at run time */
+#define CONSTEXPR_ASSERT(condition, msg) unipp::ConstexprAssert(condition, msg)
+#define CONSTEXPR_ASSERT_EQUAL(a, b, msg) unipp::ConstexprAssert((a) == (b), msg)
 
+/** Death tests: the statement runs in a forked child, see unipp::Dies */
+#define ASSERT_DEATH(statement, pattern, msg) BASE_ASSERT(unipp::Dies([&]() { statement; }, unipp::Died(), pattern, msg);)
+#define ASSERT_EXIT(statement, predicate, pattern, msg) BASE_ASSERT(unipp::Dies([&]() { statement; }, predicate, pattern, msg);)
+#define EXPECT_DEATH(statement, pattern, msg) BASE_EXPECT(unipp::Dies([&]() { statement; }, unipp::Died(), pattern, msg);)
+#define EXPECT_EXIT(statement, predicate, pattern, msg) BASE_EXPECT(unipp::Dies([&]() { statement; }, predicate, pattern, msg);)
 
-            /**
-             * @brief Adds tests to the suite.
-             */
-            template<typename... Tests>
-            void AddTests(Tests... tests)
-            {
-                  (tests_.push_back(tests), ...);
-            }
+/** Golden file comparisons, see unipp::Snapshot */
+#define ASSERT_SNAPSHOT(actual, path, msg) BASE_ASSERT(unipp::Snapshot(actual, path, msg);)
+#define EXPECT_SNAPSHOT(actual, path, msg) BASE_EXPECT(unipp::Snapshot(actual, path, msg);)
 
+/**
+ * Allocation free scopes: UNIPP_ASSERT_NO_ALLOC { ... } fails the test if the
+ * block allocates or frees heap memory on the current thread (the EXPECT
+ * version warns). Needs UNIPP_ALLOC_HOOKS defined in one source file.
+ */
+#define UNIPP_NO_ALLOC_SCOPE(fatal) if (unipp::detail::NoAllocScope unipp_no_alloc_scope{__FILE__, __LINE__, fatal}; false) {} else
+#define UNIPP_ASSERT_NO_ALLOC UNIPP_NO_ALLOC_SCOPE(true)
+#define UNIPP_EXPECT_NO_ALLOC UNIPP_NO_ALLOC_SCOPE(false)
 
-            /**
-             * @brief Run the tests in the suite.
-             */
-            void Run()
-            {
-                  std::cout << "[SUITE | " << this->name_ << " | " << this->description_ << "]" << std::endl;
-                  for (auto test : tests_) {
-                        test.Run();
-                  }
-                  std::cout << "[END SUITE]" << std::endl << std::endl;
-            }
-      private:
-            std::string name_;
-            std::string description_;
-            std::vector<UnitTest> tests_;
-      };
 
+/** Linkage of what light sources share with the rest, see the build modes above */
+#if defined(UNIPP_LIGHT) || defined(UNIPP_IMPLEMENTATION)
+#define UNIPP_API
+#else
+#define UNIPP_API inline
+#endif // UNIPP_LIGHT || UNIPP_IMPLEMENTATION
 
-      /**
-       * @brief TestRunner class.
-       *        Runs the tests in the test suites.
-       */
-      class TestRunner
+namespace unipp
+{
+      namespace detail
       {
-      public:
-            /** Base case for the recursive variadic template */
-            static void RunAll() { }
-
-            /**
-             * @brief Variadic template for running SUITES.
-             *
-             *        RUN(
-             *              SUITE("My Suite", "This is a suite description",
-             *                    TEST("My Test", "This is a test description", []() { ... }),
-             *                    TEST("My Test 2", "This is a test description", []() { ... }),
-             *                    TEST("My Test 3", "This is a test description", []() { ... })
-             *              ),
-             *              SUITE("My Suite 2", "This is a suite description",
-             *                    TEST("My Test", "This is a test description", []() { ... }),
-             *                    TEST("My Test 2", "This is a test description", []() { ... }),
-             *                    TEST("My Test 3", "This is a test description", []() { ... })
-             *              )
-             *        );
-             *
-             * @tparam TestSuites
-             * @param suites
-             */
-            template<typename... TestSuites>
-            static void RunAll(TestSuite suite, TestSuites... suites)
-            {
-                  suite.Run();
-                  RunAll(suites...);
-            }
-
-            /**
-             * @brief Variadic template for running TESTS.
-             *
-             *        RUN(
-             *              TEST("My Test", "This is a test description", []() { ... }),
-             *              TEST("My Test 2", "This is a test description", []() { ... })
-             *        );
-             *
-             * @tparam Tests
-             * @param suites
-             */
-            template<typename... Tests>
-            static void RunAll(UnitTest test, Tests... tests)
-            {
-                  test.Run();
-                  RunAll(tests...);
-            }
-            
-      private:
-            TestRunner() {}
-      };
+            /** Reports a check of the current test that passed */
+            UNIPP_API void Pass();
 
+            /** Fails the current test, keeping the first failure as its message */
+            UNIPP_API void Fail(std::string_view message);
 
-      /**
-       * @brief Benchmark a function.
-       *        Returns the average execution time of the function.
-       *
-       * @param function
-       * @param iterations
-       * @return BenchmarkResult
-       */
-      BenchmarkResult Benchmark(TestFunction test, int iterations)
-      {
-            std::chrono::milliseconds total_time = std::chrono::milliseconds(0);
+            /** Reports an EXPECT that did not hold, without failing the test */
+            UNIPP_API void Warn(std::string_view message);
 
-            for (int i = 0; i < iterations; i++) {
-                  auto start = std::chrono::high_resolution_clock::now();
-                  test();
-                  auto end = std::chrono::high_resolution_clock::now();
-                  total_time += std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-            }
+            /** Throws the failure of an assertion function, out of line so callers stay small */
+            [[noreturn]] UNIPP_API void Raise(std::string_view message);
 
-            BenchmarkResult result(total_time, total_time / iterations);
-            return result;
+            /** Adds a TEST_CASE to the tests of the binary, returns true so it can initialise a static */
+            UNIPP_API bool Register(const char* suite, const char* name, const char* description, void (*body)(), const char* file);
       }
 
-      /** Inline functions */
-      inline void Assert(bool condition, std::string message = "")
-      {
-            if (!condition) {
-                  throw std::runtime_error(message);
-            }
-      }
+      /** Assertion functions: they throw when the check fails, the macros turn that into a failed test */
+      UNIPP_API void Assert(bool condition, std::string_view message = "");
+      UNIPP_API void True(bool a, std::string_view message = "");
+      UNIPP_API void False(bool a, std::string_view message = "");
 
       template<typename T>
-      inline void Equal(T a, T b, std::string message = "")
+      inline void Equal(T a, T b, std::string_view message = "")
       {
             if (a != b) {
-                  throw std::runtime_error(message);
+                  detail::Raise(message);
             }
       }
 
       template<typename T>
-      inline void NotEqual(T a, T b, std::string message = "")
+      inline void NotEqual(T a, T b, std::string_view message = "")
       {
             if (a == b) {
-                  throw std::runtime_error(message);
+                  detail::Raise(message);
             }
       }
 
       template<typename T>
-      inline void Greater(T a, T b, std::string message = "")
+      inline void Greater(T a, T b, std::string_view message = "")
       {
             if (a <= b) {
-                  throw std::runtime_error(message);
+                  detail::Raise(message);
             }
       }
 
       template<typename T>
-      inline void GreaterEqual(T a, T b, std::string message = "")
+      inline void GreaterEqual(T a, T b, std::string_view message = "")
       {
             if (a < b) {
-                  throw std::runtime_error(message);
+                  detail::Raise(message);
             }
       }
 
       template<typename T>
-      inline void Less(T a, T b, std::string message = "")
+      inline void Less(T a, T b, std::string_view message = "")
       {
             if (a >= b) {
-                  throw std::runtime_error(message);
+                  detail::Raise(message);
             }
       }
 
       template<typename T>
-      inline void LessEqual(T a, T b, std::string message = "")
+      inline void LessEqual(T a, T b, std::string_view message = "")
       {
             if (a > b) {
-                  throw std::runtime_error(message);
+                  detail::Raise(message);
             }
       }
 
       template<typename T>
-      inline void Null(T a, std::string message = "")
+      inline void Null(T a, std::string_view message = "")
       {
             if (a != nullptr) {
-                  throw std::runtime_error(message);
+                  detail::Raise(message);
             }
       }
 
       template<typename T>
-      inline void NotNull(T a, std::string message = "")
+      inline void NotNull(T a, std::string_view message = "")
       {
             if (a == nullptr) {
-                  throw std::runtime_error(message);
+                  detail::Raise(message);
             }
       }
 
-      inline void True(bool a, std::string message = "")
+
+      /** Floating point comparisons */
+
+      /**
+       * @brief How NaN values are treated by the approximate comparisons.
+       *        By default a NaN is not equal to anything, itself included.
+       */
+      enum class NanPolicy { Unequal, Equal };
+
+      /**
+       * @brief How infinities are treated by the approximate comparisons.
+       *        MatchSign only accepts an infinity of the same sign, Reject
+       *        fails every comparison that involves one.
+       */
+      enum class InfPolicy { MatchSign, Reject };
+
+      /**
+       * @brief Tolerance used by the approximate comparisons.
+       *        Two finite values are equal if they pass any of the enabled
+       *        criteria: absolute error, error relative to the largest
+       *        magnitude, or distance in units in the last place.
+       *
+       *        ASSERT_NEAR(x, 0.3, 1e-12, "...");
+       *        ASSERT_NEAR(x, y, unipp::Tolerance::Ulps(4), "...");
+       *        ASSERT_ARRAY_NEAR(out, expected,
+       *              unipp::Tolerance::Relative(1e-9).Nan(unipp::NanPolicy::Equal), "...");
+       */
+      struct Tolerance
       {
-            if (!a) {
-                  throw std::runtime_error(message);
-            }
+            double absolute = 0.0;
+            double relative = 0.0;
+            std::uint64_t ulps = 0;
+            NanPolicy nan = NanPolicy::Unequal;
+            InfPolicy inf = InfPolicy::MatchSign;
+
+            Tolerance() {}
+            Tolerance(double absolute) : absolute(absolute) {}
+
+            static Tolerance Absolute(double epsilon) { return Tolerance(epsilon); }
+            static Tolerance Relative(double epsilon) { Tolerance t; t.relative = epsilon; return t; }
+            static Tolerance Ulps(std::uint64_t count) { Tolerance t; t.ulps = count; return t; }
+
+            Tolerance& Nan(NanPolicy policy) { nan = policy; return *this; }
+            Tolerance& Inf(InfPolicy policy) { inf = policy; return *this; }
+      };
+
+      namespace detail
+      {
+            /** Only float and double have a well defined ULP distance */
+            template<typename A, typename B>
+            struct NearType
+            {
+                  typedef typename std::conditional<
+                        std::is_same<A, float>::value && std::is_same<B, float>::value, float, double>::type type;
+            };
+
+            /** Out of line halves of Near and ArrayNear, which need the heavy headers */
+            UNIPP_API void CheckNear(float a, float b, const Tolerance& tolerance, std::string_view message);
+            UNIPP_API void CheckNear(double a, double b, const Tolerance& tolerance, std::string_view message);
+            UNIPP_API void CheckArrayNear(const float* a, const float* b, std::size_t size,
+                                          const Tolerance& tolerance, std::string_view message);
+            UNIPP_API void CheckArrayNear(const double* a, const double* b, std::size_t size,
+                                          const Tolerance& tolerance, std::string_view message);
+            UNIPP_API void CheckSizes(std::size_t a, std::size_t b, std::string_view message);
       }
 
-      inline void False(bool a, std::string message = "")
+      template<typename A, typename B>
+      inline void Near(A a, B b, Tolerance tolerance, std::string_view message = "")
       {
-            if (a) {
-                  throw std::runtime_error(message);
-            }
+            typedef typename detail::NearType<A, B>::type T;
+            detail::CheckNear(static_cast<T>(a), static_cast<T>(b), tolerance, message);
+      }
+
+      template<typename T>
+      inline void ArrayNear(const T* a, const T* b, std::size_t size, Tolerance tolerance, std::string_view message = "")
+      {
+            static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value,
+                          "ArrayNear only supports float and double");
+            detail::CheckArrayNear(a, b, size, tolerance, message);
+      }
+
+      /** Container overload, anything with data() and size() */
+      template<typename A, typename B>
+      inline void ArrayNear(const A& a, const B& b, Tolerance tolerance, std::string_view message = "")
+      {
+            detail::CheckSizes(a.size(), b.size(), message);
+            ArrayNear(a.data(), b.data(), a.size(), tolerance, message);
       }
 }
 
 
+#if !defined(UNIPP_LIGHT)
+
+/** C++ headers */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+#include <memory>
+#include <new>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <map>
+#include <deque>
+#include <cstdio>
+#include <iterator>
+#include <tuple>
+#include <utility>
+#include <filesystem>
+#include <string_view>
+#include <charconv>
+#include <regex>
+#include <bitset>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif // __SSE2__
+
+/** Keeps the fuzzing engine itself out of the coverage it measures */
+#if defined(UNIPP_FUZZ_COVERAGE) && defined(__clang__)
+#define UNIPP_NO_COVERAGE __attribute__((no_sanitize("coverage")))
+#elif defined(UNIPP_FUZZ_COVERAGE)
+#define UNIPP_NO_COVERAGE __attribute__((no_sanitize_coverage))
+#else
+#define UNIPP_NO_COVERAGE
+#endif // UNIPP_FUZZ_COVERAGE
+
+/** Platform headers */
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <dlfcn.h>
+#define UNIPP_HAS_MMAP 1
+#define UNIPP_HAS_FORK 1
+#define UNIPP_HAS_DLOPEN 1
+#endif // __unix__ || __APPLE__
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#define UNIPP_HAS_INOTIFY 1
+#endif // __linux__
+
+#if defined(__APPLE__)
+#include <mach-o/dyld.h>
+#endif // __APPLE__
+
+#if defined(__linux__) && defined(__GLIBC__)
+#include <execinfo.h>
+#include <cxxabi.h>
+#include <signal.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#define UNIPP_HAS_STACKTRACE 1
+#ifndef UNIPP_STACK_SIGNAL
+#define UNIPP_STACK_SIGNAL (SIGRTMIN + 4)
+#endif // UNIPP_STACK_SIGNAL
+#endif // __linux__ && __GLIBC__
+
+/** Async tests need C++20 coroutines */
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#define UNIPP_HAS_COROUTINES 1
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define UNIPP_HAS_EPOLL 1
+#endif // __linux__
+#endif // __cpp_impl_coroutine
+
+namespace unipp
+{
+      /** Type definitions */
+      typedef std::function<void()> TestFunction;
+
+      /** Structs */
+      struct BenchmarkResult {
+            std::chrono::milliseconds total;
+            std::chrono::milliseconds average;
+
+            BenchmarkResult(std::chrono::milliseconds total, std::chrono::milliseconds average)
+                  : total(total), average(average) {}
+
+            void Show()
+            {
+                  std::cout << "   [BENCHMARK] Total time: " << total.count() << "ms" << std::endl;
+                  std::cout << "   [BENCHMARK] Average time: " << average.count() << "ms" << std::endl;
+            }
+      };
+
+      /**
+       * @brief Outcome of a single test
+       */
+      enum class TestStatus { Passed, Failed, TimedOut, Cached, Flaky };
+
+      inline const char* ToString(TestStatus status)
+      {
+            switch (status) {
+                  case TestStatus::Passed: return "passed";
+                  case TestStatus::Failed: return "failed";
+                  case TestStatus::TimedOut: return "timed out";
+                  case TestStatus::Cached: return "cached";
+                  case TestStatus::Flaky: return "flaky";
+            }
+            return "unknown";
+      }
+
+      struct TestResult
+      {
+            std::string suite;
+            std::string name;
+            TestStatus status = TestStatus::Passed;
+            std::chrono::nanoseconds duration{0};
+            std::string message;
+            std::string output;
+            std::uint64_t fingerprint = 0;
+            std::size_t attempts = 1;
+            // Failed, but --quarantine keeps it from failing the run
+            bool quarantined = false;
+      };
+
+      /**
+       * @brief Run wide options.
+       *        Every option can be given on the command line through
+       *        CONFIGURE(argc, argv) as --name=value, or through the
+       *        environment as UNIPP_NAME=value (dashes become underscores).
+       *
+       *        --timeout=<ms>    Default time limit for every test (0 = none)
+       *        --jobs=<n>        Tests to run at once (0 = one per core)
+       *        --cache=<path>    Local cache file for test history ("" = none),
+       *                          only used by --jobs, --incremental, --reruns
+       *                          and --quarantine
+       *        --incremental     Skip tests whose inputs did not change since
+       *                          they last passed
+       *        --cases=<n>       Cases per property test
+       *        --seed=<n>        Seed for generated cases (0 = a fresh one per run)
+       *        --fuzz=<name>     Fuzz the FUZZ test with this name (* = all)
+       *        --fuzz-runs=<n>   Inputs to try when fuzzing (0 = no limit)
+       *        --fuzz-time=<s>   Time limit when fuzzing (0 = no limit)
+       *        --fuzz-max-len=<n> Largest input to generate when fuzzing
+       *        --corpus=<dir>    Where FUZZ tests keep their corpus directories
+       *        --update-snapshots Rewrite golden files instead of comparing
+       *        --filter=<globs>  Only run the tests matching one of these
+       *                          comma separated globs (* and ?)
+       *        --repeat=<n>      Run every test n times, stopping at the
+       *                          first failure
+       *        --threads=<k>     Run every repetition on k threads at once
+       *        --jitter=<us>     Most a thread's start is randomly delayed
+       *                          by, with --threads
+       *        --schedules=<n>   Most schedules an INTERLEAVINGS test tries
+       *        --preemptions=<n> Preemption bound of the systematic search
+       *                          INTERLEAVINGS tests start with
+       *        --replay=<schedule> Run INTERLEAVINGS tests under this one
+       *                          schedule, as printed when one failed
+       *        --list            Print the selected suites and tests as JSON
+       *                          instead of running them
+       *        --junit=<path>    Stream results as JUnit XML to this file (- =
+       *                          stdout, the console output then goes to stderr)
+       *        --tap=<path>      Stream results as TAP to this file (- = stdout)
+       *        --reruns=<n>      Rerun failed tests up to n times, those that
+       *                          then pass are flaky
+       *        --quarantine      Failures of tests flaky in at least a tenth of
+       *                          their last 32 runs do not fail the run
+       *        --watch           With RUN_MODULES, rerun the tests of every
+       *                          module that gets rebuilt
+       *        --shard=<i>/<n>   Only run every n-th selected test, starting
+       *                          with the i-th (from 0), see tools/unipp-run.cpp
+       *        --results=<fd>    Publish results to the shared memory channel
+       *                          of the runner that started this binary
+       */
+      struct Options
+      {
+            std::chrono::milliseconds timeout{0};
+            unsigned jobs = 1;
+            std::string cache = ".unipp_cache";
+            bool incremental = false;
+            std::size_t cases = 100;
+            std::uint64_t seed = 0;
+            std::string fuzz;
+            std::size_t fuzz_runs = 0;
+            std::size_t fuzz_time = 60;
+            std::size_t fuzz_max_len = 4096;
+            std::string corpus = "corpus";
+            bool update_snapshots = false;
+            std::string filter;
+            std::size_t repeat = 1;
+            unsigned threads = 1;
+            std::chrono::microseconds jitter{100};
+            std::size_t schedules = 1000;
+            std::size_t preemptions = 2;
+            std::string replay;
+            bool list = false;
+            std::string junit;
+            std::string tap;
+            std::size_t reruns = 0;
+            bool quarantine = false;
+            bool watch = false;
+            std::size_t shard_index = 0;
+            std::size_t shard_count = 1;
+            int results = -1;
+      };
+
+      namespace detail
+      {
+            /** Names of the options that can also be set through the environment */
+            inline const char* const kOptionNames[] = { "timeout", "jobs", "cache", "incremental", "cases", "seed",
+                                             "fuzz", "fuzz-runs", "fuzz-time", "fuzz-max-len", "corpus",
+                                             "update-snapshots", "filter", "repeat", "threads", "jitter",
+                                             "schedules", "preemptions", "replay", "list", "junit", "tap", "reruns", "quarantine", "watch", "shard",
+                                             "results" };
+
+            /** Flags accept no value, 1/0 or true/false */
+            inline bool ParseFlag(const std::string& value)
+            {
+                  if (value.empty() || value == "1" || value == "true") {
+                        return true;
+                  }
+                  if (value == "0" || value == "false") {
+                        return false;
+                  }
+                  throw std::invalid_argument(value);
+            }
+
+            /**
+             * @brief Applies a single option to the given set.
+             *        Returns false if the option is unknown or its value is invalid.
+             */
+            inline bool ParseOption(Options& options, const std::string& name, const std::string& value)
+            {
+                  try {
+                        if (name == "timeout") {
+                              options.timeout = std::chrono::milliseconds(std::stoll(value));
+                              return true;
+                        }
+                        if (name == "jobs") {
+                              options.jobs = static_cast<unsigned>(std::stoul(value));
+                              if (options.jobs == 0) {
+                                    options.jobs = std::max(1u, std::thread::hardware_concurrency());
+                              }
+                              return true;
+                        }
+                        if (name == "cache") {
+                              options.cache = value;
+                              return true;
+                        }
+                        if (name == "incremental") {
+                              options.incremental = ParseFlag(value);
+                              return true;
+                        }
+                        if (name == "cases") {
+                              options.cases = std::stoull(value);
+                              return true;
+                        }
+                        if (name == "seed") {
+                              options.seed = std::stoull(value);
+                              return true;
+                        }
+                        if (name == "fuzz") {
+                              options.fuzz = value.empty() ? "*" : value;
+                              return true;
+                        }
+                        if (name == "fuzz-runs") {
+                              options.fuzz_runs = std::stoull(value);
+                              return true;
+                        }
+                        if (name == "fuzz-time") {
+                              options.fuzz_time = std::stoull(value);
+                              return true;
+                        }
+                        if (name == "fuzz-max-len") {
+                              options.fuzz_max_len = std::stoull(value);
+                              return true;
+                        }
+                        if (name == "corpus") {
+                              options.corpus = value;
+                              return true;
+                        }
+                        if (name == "update-snapshots") {
+                              options.update_snapshots = ParseFlag(value);
+                              return true;
+                        }
+                        if (name == "filter") {
+                              options.filter = value;
+                              return true;
+                        }
+                        if (name == "repeat") {
+                              options.repeat = std::max<std::size_t>(1, std::stoull(value));
+                              return true;
+                        }
+                        if (name == "threads") {
+                              options.threads = std::max(1u, static_cast<unsigned>(std::stoul(value)));
+                              return true;
+                        }
+                        if (name == "jitter") {
+                              options.jitter = std::chrono::microseconds(std::stoll(value));
+                              return true;
+                        }
+                        if (name == "schedules") {
+                              options.schedules = std::max<std::size_t>(1, std::stoull(value));
+                              return true;
+                        }
+                        if (name == "preemptions") {
+                              options.preemptions = std::stoull(value);
+                              return true;
+                        }
+                        if (name == "replay") {
+                              options.replay = value;
+                              return true;
+                        }
+                        if (name == "list") {
+                              options.list = ParseFlag(value);
+                              return true;
+                        }
+                        if (name == "junit") {
+                              options.junit = value;
+                              return true;
+                        }
+                        if (name == "tap") {
+                              options.tap = value;
+                              return true;
+                        }
+                        if (name == "reruns") {
+                              options.reruns = std::stoull(value);
+                              return true;
+                        }
+                        if (name == "quarantine") {
+                              options.quarantine = ParseFlag(value);
+                              return true;
+                        }
+                        if (name == "watch") {
+                              options.watch = ParseFlag(value);
+                              return true;
+                        }
+                        if (name == "shard") {
+                              const std::size_t slash = value.find('/');
+                              const std::size_t index = std::stoull(value.substr(0, slash));
+                              const std::size_t count = slash == std::string::npos ? 0 : std::stoull(value.substr(slash + 1));
+                              if (count == 0 || index >= count) {
+                                    throw std::invalid_argument(value);
+                              }
+                              options.shard_index = index;
+                              options.shard_count = count;
+                              return true;
+                        }
+                        if (name == "results") {
+                              options.results = std::stoi(value);
+                              return true;
+                        }
+                  }
+                  catch (const std::exception&) {
+                        std::cerr << "[!] Invalid value for option " << name << ": " << value << std::endl;
+                  }
+                  return false;
+            }
+
+            inline Options OptionsFromEnvironment()
+            {
+                  Options options;
+                  for (const char* name : kOptionNames) {
+                        std::string variable = std::string("UNIPP_") + name;
+                        for (char& c : variable) {
+                              c = c == '-' ? '_' : static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+                        }
+                        if (const char* value = std::getenv(variable.c_str())) {
+                              ParseOption(options, name, value);
+                        }
+                  }
+                  return options;
+            }
+      }
+
+      inline Options& GetOptions()
+      {
+            static Options options = detail::OptionsFromEnvironment();
+            return options;
+      }
+
+      namespace detail
+      {
+            /** Set while a test's output is echoed to the console, which ConsoleCapture must let through */
+            inline bool& Echoing()
+            {
+                  static thread_local bool echoing = false;
+                  return echoing;
+            }
+
+            /**
+             * @brief Stream buffer collecting a test's output.
+             *        Writes are serialised, so a test may log from several
+             *        threads, and are optionally echoed to the console as
+             *        they happen.
+             */
+            class OutputCapture : public std::streambuf
+            {
+            public:
+                  explicit OutputCapture(bool echo) : echo_(echo) {}
+
+                  std::string Text()
+                  {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        return text_;
+                  }
+
+                  void Clear()
+                  {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        text_.clear();
+                  }
+
+            protected:
+                  int overflow(int c) override
+                  {
+                        if (c != traits_type::eof()) {
+                              const char character = static_cast<char>(c);
+                              xsputn(&character, 1);
+                        }
+                        return c;
+                  }
+
+                  std::streamsize xsputn(const char* data, std::streamsize size) override
+                  {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        text_.append(data, static_cast<std::size_t>(size));
+                        if (echo_) {
+                              Echoing() = true;
+                              std::cout.write(data, size);
+                              Echoing() = false;
+                        }
+                        return size;
+                  }
+
+                  int sync() override
+                  {
+                        if (echo_) {
+                              std::lock_guard<std::mutex> lock(mutex_);
+                              std::cout.flush();
+                        }
+                        return 0;
+                  }
+
+            private:
+                  std::mutex mutex_;
+                  std::string text_;
+                  bool echo_;
+            };
+
+            /**
+             * @brief State of the test running on the current thread.
+             *        Assertion macros report their failures here.
+             */
+            struct TestContext
+            {
+                  std::mutex mutex;
+                  bool failed = false;
+                  std::string message;
+                  OutputCapture capture;
+                  std::ostream out;
+                  // When waits inside the test give up, a little before its watchdog would fire
+                  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+                  // Passing assertions say nothing, for tests repeated thousands of times
+                  bool quiet = false;
+
+                  explicit TestContext(bool echo) : capture(echo), out(&capture) {}
+            };
+
+            inline TestContext*& CurrentContext()
+            {
+                  static thread_local TestContext* context = nullptr;
+                  return context;
+            }
+
+            /** Where test output goes, the console unless the runner says otherwise */
+            inline std::ostream& Out()
+            {
+                  TestContext* context = CurrentContext();
+                  return context ? context->out : std::cout;
+            }
+
+            /**
+             * @brief Installed in std::cout or std::cerr while reports are
+             *        written: what a test writes to it from its own thread
+             *        goes into the test's output along with the runner's
+             *        lines about the test, so the reports carry it. Writes
+             *        from other threads go through as usual.
+             */
+            class ConsoleCapture : public std::streambuf
+            {
+            public:
+                  explicit ConsoleCapture(std::ostream& stream) : stream_(stream), original_(stream.rdbuf(this)) {}
+
+                  ~ConsoleCapture() override
+                  {
+                        stream_.rdbuf(original_);
+                  }
+
+                  ConsoleCapture(const ConsoleCapture&) = delete;
+                  ConsoleCapture& operator=(const ConsoleCapture&) = delete;
+
+            protected:
+                  int overflow(int c) override
+                  {
+                        if (c != traits_type::eof()) {
+                              const char character = static_cast<char>(c);
+                              xsputn(&character, 1);
+                        }
+                        return c;
+                  }
+
+                  std::streamsize xsputn(const char* data, std::streamsize size) override
+                  {
+                        TestContext* context = CurrentContext();
+                        if (!context || Echoing()) {
+                              return original_->sputn(data, size);
+                        }
+                        context->out.write(data, size);
+                        return size;
+                  }
+
+                  int sync() override
+                  {
+                        return original_->pubsync();
+                  }
+
+            private:
+                  std::ostream& stream_;
+                  std::streambuf* original_;
+            };
+
+            UNIPP_API void Pass()
+            {
+                  TestContext* context = CurrentContext();
+                  if (!context || !context->quiet) {
+                        Out() << "      [√] PASSED" << std::endl << std::endl;
+                  }
+            }
+
+            UNIPP_API void Fail(std::string_view message)
+            {
+                  if (TestContext* context = CurrentContext()) {
+                        std::lock_guard<std::mutex> lock(context->mutex);
+                        if (!context->failed) {
+                              context->failed = true;
+                              context->message = std::string(message);
+                        }
+                  }
+                  Out() << "      [X] FAILED: " << message << std::endl;
+            }
+
+            UNIPP_API void Warn(std::string_view message)
+            {
+                  Out() << "      [!] WARNING: " << message << std::endl;
+            }
+
+            UNIPP_API void Raise(std::string_view message)
+            {
+                  throw std::runtime_error(std::string(message));
+            }
+
+            /** Runs a test body on the calling thread, catching whatever escapes it */
+            inline void Invoke(const TestFunction& test, TestContext& context)
+            {
+                  TestContext* previous = CurrentContext();
+                  CurrentContext() = &context;
+                  try {
+                        test();
+                  }
+                  catch (const std::exception& e) {
+                        Fail(std::string("Uncaught exception: ") + e.what());
+                  }
+                  catch (...) {
+                        Fail("Uncaught exception");
+                  }
+                  CurrentContext() = previous;
+            }
+
+            /**
+             * @brief Context for the cases of a test that runs many of them
+             *        (rows, generated values), on whichever thread runs them.
+             *        One per thread, reused from case to case: passing
+             *        assertions say nothing, EXPECT warnings are dropped, and
+             *        Held turns an ASSERT that failed into the case's
+             *        failure, so it is reported with the case's position.
+             */
+            class CaseScope
+            {
+            public:
+                  explicit CaseScope(const TestContext* test) : context_(false), previous_(CurrentContext())
+                  {
+                        context_.quiet = true;
+                        if (test) {
+                              context_.deadline = test->deadline;
+                        }
+                        CurrentContext() = &context_;
+                  }
+
+                  ~CaseScope()
+                  {
+                        CurrentContext() = previous_;
+                  }
+
+                  CaseScope(const CaseScope&) = delete;
+                  CaseScope& operator=(const CaseScope&) = delete;
+
+                  /** Whether the case that just ran held, given what it returned, error is its message if not */
+                  bool Held(bool held, std::string& error)
+                  {
+                        if (context_.failed) {
+                              held = false;
+                              error = context_.message;
+                              context_.failed = false;
+                              context_.message.clear();
+                        }
+                        context_.capture.Clear();
+                        return held;
+                  }
+
+            private:
+                  TestContext context_;
+                  TestContext* previous_;
+            };
+
+            /** Whether the test running on the current thread has failed */
+            inline bool Failed()
+            {
+                  TestContext* context = CurrentContext();
+                  if (!context) {
+                        return false;
+                  }
+                  std::lock_guard<std::mutex> lock(context->mutex);
+                  return context->failed;
+            }
+
+            /**
+             * @brief Runs a setup or teardown hook on the calling thread.
+             *        Its output is left in output, and the returned message is
+             *        empty unless the hook failed.
+             */
+            inline std::string RunHook(const TestFunction& hook, const std::string& header, bool echo, std::string& output)
+            {
+                  TestContext context(echo);
+                  context.out << header << std::endl;
+                  Invoke(hook, context);
+                  output = context.capture.Text();
+                  return context.failed ? context.message : "";
+            }
+
+            /**
+             * @brief Wraps a test body with the per test hooks of its suite.
+             *        The body is skipped if before fails, and after runs
+             *        either way so it can undo whatever before did.
+             */
+            inline TestFunction WithHooks(TestFunction body, TestFunction before, TestFunction after)
+            {
+                  return [body, before, after]() {
+                        try {
+                              if (before) {
+                                    before();
+                              }
+                              if (!Failed()) {
+                                    body();
+                              }
+                        }
+                        catch (...) {
+                              if (after) {
+                                    after();
+                              }
+                              throw;
+                        }
+                        if (after) {
+                              after();
+                        }
+                  };
+            }
+
+            /** Timed out bodies that are still running on an abandoned worker */
+            inline std::atomic<std::size_t>& Stranded()
+            {
+                  static std::atomic<std::size_t> count{0};
+                  return count;
+            }
+
+            /**
+             * @brief Runs a test body under a time limit.
+             *        The body runs on its own thread while the calling thread
+             *        acts as its watchdog. On expiry the worker is abandoned
+             *        (it keeps its own copy of the body and shares ownership
+             *        of the context), counted in Stranded until it returns,
+             *        and false is returned. The body may still be using its
+             *        suite's fixture, so the runner ends the run rather than
+             *        moving on, see TestRunner::Tally::Abandon.
+             */
+            inline bool Execute(const TestFunction& test, std::shared_ptr<TestContext> context, std::chrono::milliseconds limit)
+            {
+                  if (limit.count() <= 0) {
+                        Invoke(test, *context);
+                        return true;
+                  }
+
+                  struct Watch
+                  {
+                        std::mutex mutex;
+                        std::condition_variable done_signal;
+                        bool done = false;
+                        bool abandoned = false;
+                  };
+
+                  auto watch = std::make_shared<Watch>();
+                  std::thread worker([test, context, watch]() {
+                        Invoke(test, *context);
+                        std::lock_guard<std::mutex> lock(watch->mutex);
+                        watch->done = true;
+                        if (watch->abandoned) {
+                              Stranded()--;
+                        }
+                        watch->done_signal.notify_all();
+                  });
+
+                  std::unique_lock<std::mutex> lock(watch->mutex);
+                  const bool finished = watch->done_signal.wait_for(lock, limit, [&watch]() { return watch->done; });
+                  if (!finished) {
+                        watch->abandoned = true;
+                        Stranded()++;
+                  }
+                  lock.unlock();
+
+                  if (finished) {
+                        worker.join();
+                  }
+                  else {
+                        worker.detach();
+                  }
+                  return finished;
+            }
+
+#if defined(UNIPP_HAS_STACKTRACE)
+            inline constexpr int kMaxStackFrames = 64;
+
+            /**
+             * @brief Where the signal handler leaves a thread's stack. There
+             *        is one, static so that a handler running late never
+             *        writes into freed memory. Each request has a generation:
+             *        the handler claims it (only on the thread it is meant
+             *        for) before writing, and tags the frames with it once
+             *        done.
+             */
+            struct StackSnapshot
+            {
+                  void* frames[kMaxStackFrames];
+                  int depth = 0;
+                  std::atomic<pid_t> target{0};
+                  std::atomic<std::uint64_t> request{0};
+                  std::atomic<std::uint64_t> written{0};
+            };
+
+            inline StackSnapshot& Snapshot()
+            {
+                  static StackSnapshot snapshot;
+                  return snapshot;
+            }
+
+            inline void SnapshotSignalHandler(int)
+            {
+                  StackSnapshot& snapshot = Snapshot();
+                  std::uint64_t generation = snapshot.request.load();
+                  if (generation == 0 || snapshot.target.load() != static_cast<pid_t>(syscall(SYS_gettid))
+                      || !snapshot.request.compare_exchange_strong(generation, 0)) {
+                        return;
+                  }
+                  snapshot.depth = backtrace(snapshot.frames, kMaxStackFrames);
+                  snapshot.written.store(generation);
+            }
+
+            inline std::string ThreadName(const std::string& tid)
+            {
+                  std::ifstream comm("/proc/self/task/" + tid + "/comm");
+                  std::string name;
+                  std::getline(comm, name);
+                  return name;
+            }
+
+            /** Demangles the symbol in a "module(symbol+offset) [address]" frame */
+            inline std::string DemangleFrame(const char* frame)
+            {
+                  std::string text = frame;
+                  const std::size_t open = text.find('(');
+                  const std::size_t plus = text.find('+', open);
+                  if (open == std::string::npos || plus == std::string::npos || plus == open + 1) {
+                        return text;
+                  }
+                  int status = 0;
+                  char* name = abi::__cxa_demangle(text.substr(open + 1, plus - open - 1).c_str(), nullptr, nullptr, &status);
+                  if (status == 0 && name) {
+                        text = text.substr(0, open + 1) + name + text.substr(plus);
+                  }
+                  std::free(name);
+                  return text;
+            }
+
+            /**
+             * @brief Captures the stack of every other thread in the process.
+             *        Each thread is interrupted in turn with UNIPP_STACK_SIGNAL
+             *        and records its own backtrace from the signal handler.
+             *        The handler is installed for the rest of the process, so
+             *        a signal still pending on a thread that blocks it is
+             *        harmless once it gets through.
+             */
+            inline std::string CaptureStacks()
+            {
+                  static std::mutex capture_mutex;
+                  std::lock_guard<std::mutex> capture_lock(capture_mutex);
+
+                  static const bool installed = []() {
+                        // The first backtrace() call may allocate, get it out of the way
+                        void* warmup[1];
+                        backtrace(warmup, 1);
+
+                        struct sigaction action;
+                        std::memset(&action, 0, sizeof(action));
+                        action.sa_handler = SnapshotSignalHandler;
+                        sigemptyset(&action.sa_mask);
+                        action.sa_flags = SA_RESTART;
+                        return sigaction(UNIPP_STACK_SIGNAL, &action, nullptr) == 0;
+                  }();
+                  if (!installed) {
+                        return "         <could not install the stack signal handler>\n";
+                  }
+
+                  static std::uint64_t generation = 0;
+                  StackSnapshot& snapshot = Snapshot();
+                  std::ostringstream stacks;
+                  const pid_t self = static_cast<pid_t>(syscall(SYS_gettid));
+                  if (DIR* tasks = opendir("/proc/self/task")) {
+                        while (dirent* entry = readdir(tasks)) {
+                              const pid_t tid = static_cast<pid_t>(std::atoi(entry->d_name));
+                              if (entry->d_name[0] == '.' || tid == self) {
+                                    continue;
+                              }
+
+                              const std::uint64_t current = ++generation;
+                              snapshot.target.store(tid);
+                              snapshot.request.store(current);
+                              if (syscall(SYS_tgkill, getpid(), tid, UNIPP_STACK_SIGNAL) == 0) {
+                                    for (int i = 0; i < 200 && snapshot.written.load() != current; i++) {
+                                          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                                    }
+                              }
+                              // Withdraw the request, unless a handler already claimed it and is still writing
+                              std::uint64_t pending = current;
+                              if (!snapshot.request.compare_exchange_strong(pending, 0)) {
+                                    while (snapshot.written.load() != current) {
+                                          std::this_thread::yield();
+                                    }
+                              }
+
+                              stacks << "         Thread " << entry->d_name << " (" << ThreadName(entry->d_name) << "):" << std::endl;
+                              if (snapshot.written.load() != current) {
+                                    stacks << "            <unavailable>" << std::endl;
+                                    continue;
+                              }
+                              // Skip the signal handler and the signal trampoline
+                              char** symbols = backtrace_symbols(snapshot.frames, snapshot.depth);
+                              for (int i = 2; symbols && i < snapshot.depth; i++) {
+                                    stacks << "            #" << (i - 2) << " " << DemangleFrame(symbols[i]) << std::endl;
+                              }
+                              std::free(symbols);
+                        }
+                        closedir(tasks);
+                  }
+                  return stacks.str();
+            }
+#else
+            inline std::string CaptureStacks()
+            {
+                  return "         <stack traces are not supported on this platform>\n";
+            }
+#endif // UNIPP_HAS_STACKTRACE
+
+            inline std::string FormatMilliseconds(std::chrono::nanoseconds duration)
+            {
+                  return std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count()) + " ms";
+            }
+
+            /** Name a test is known by across runs */
+            inline std::string FullName(const std::string& suite, const std::string& test)
+            {
+                  return suite.empty() ? test : suite + "/" + test;
+            }
+
+            /** Quotes and escapes text as a JSON string */
+            inline std::string JsonString(const std::string& text)
+            {
+                  std::string json = "\"";
+                  for (const char c : text) {
+                        switch (c) {
+                              case '"': json += "\\\""; break;
+                              case '\\': json += "\\\\"; break;
+                              case '\n': json += "\\n"; break;
+                              case '\r': json += "\\r"; break;
+                              case '\t': json += "\\t"; break;
+                              default:
+                                    if (static_cast<unsigned char>(c) < 0x20) {
+                                          char escaped[8];
+                                          std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+                                          json += escaped;
+                                    }
+                                    else {
+                                          json += c;
+                                    }
+                        }
+                  }
+                  return json + "\"";
+            }
+
+            /**
+             * @brief What the previous runs taught us about a test.
+             *        Durations are smoothed so one noisy run does not
+             *        reshuffle the schedule.
+             */
+            struct HistoryRecord
+            {
+                  std::chrono::nanoseconds duration{0};
+                  bool failed = false;
+                  std::uint64_t fingerprint = 0;
+                  std::size_t runs = 0;
+                  std::size_t flaky = 0;
+                  // One bit per recent run, the latest in the lowest bit, set if it was flaky
+                  std::uint32_t recent = 0;
+
+                  static constexpr std::size_t kRecentRuns = 32;
+
+                  /** Share of the recorded runs that were flaky */
+                  double FlakyRate() const { return runs ? double(flaky) / double(runs) : 0.0; }
+
+                  /** How many of the last RecentRuns() runs were flaky */
+                  std::size_t RecentFlaky() const { return std::bitset<kRecentRuns>(recent).count(); }
+                  std::size_t RecentRuns() const { return std::min(runs, kRecentRuns); }
+
+                  /** Whether --quarantine covers the test: flaky in at least a tenth of its recent runs */
+                  bool Quarantined() const { return RecentFlaky() > 0 && RecentFlaky() * 10 >= RecentRuns(); }
+            };
+
+            /**
+             * @brief The local cache file, one test per line:
+             *
+             *        <suite/test>\tduration=<ns>\tfailed=<0|1>\tfingerprint=<hash>\truns=<n>\tflaky=<n>\trecent=<bits>
+             *
+             *        Unknown fields are ignored, so older binaries can read
+             *        what newer ones write.
+             */
+            class History
+            {
+            public:
+                  void Load(const std::string& path)
+                  {
+                        std::ifstream file(path);
+                        std::string line;
+                        while (std::getline(file, line)) {
+                              std::istringstream fields(line);
+                              std::string name, field;
+                              if (!std::getline(fields, name, '\t') || name.empty()) {
+                                    continue;
+                              }
+                              HistoryRecord& record = records_[name];
+                              while (std::getline(fields, field, '\t')) {
+                                    const std::size_t equals = field.find('=');
+                                    if (equals != std::string::npos) {
+                                          Parse(record, field.substr(0, equals), field.substr(equals + 1));
+                                    }
+                              }
+                        }
+                  }
+
+                  void Save(const std::string& path) const
+                  {
+                        const std::string temporary = path + ".tmp";
+                        {
+                              std::ofstream file(temporary, std::ios::trunc);
+                              for (const auto& entry : records_) {
+                                    file << entry.first
+                                         << "\tduration=" << entry.second.duration.count()
+                                         << "\tfailed=" << entry.second.failed
+                                         << "\tfingerprint=" << entry.second.fingerprint
+                                         << "\truns=" << entry.second.runs
+                                         << "\tflaky=" << entry.second.flaky
+                                         << "\trecent=" << entry.second.recent << "\n";
+                              }
+                              if (!file) {
+                                    return;
+                              }
+                        }
+                        std::rename(temporary.c_str(), path.c_str());
+                  }
+
+                  const HistoryRecord* Find(const std::string& name) const
+                  {
+                        const auto entry = records_.find(name);
+                        return entry == records_.end() ? nullptr : &entry->second;
+                  }
+
+                  void Update(const TestResult& result)
+                  {
+                        const std::string name = FullName(result.suite, result.name);
+                        const bool known = records_.count(name) != 0;
+                        HistoryRecord& record = records_[name];
+                        // Tests skipped by their suite's budget did not run, their duration says nothing
+                        if (result.duration.count() > 0) {
+                              record.duration = known ? (record.duration * 3 + result.duration) / 4 : result.duration;
+                        }
+                        const bool passed = result.status == TestStatus::Passed || result.status == TestStatus::Cached;
+                        record.failed = !passed;
+                        record.fingerprint = passed ? result.fingerprint : 0;
+                        if (result.status != TestStatus::Cached) {
+                              record.runs++;
+                              record.flaky += result.status == TestStatus::Flaky;
+                              record.recent = (record.recent << 1) | (result.status == TestStatus::Flaky ? 1u : 0u);
+                        }
+                  }
+
+            private:
+                  static void Parse(HistoryRecord& record, const std::string& key, const std::string& value)
+                  {
+                        try {
+                              if (key == "duration") {
+                                    record.duration = std::chrono::nanoseconds(std::stoll(value));
+                              }
+                              else if (key == "failed") {
+                                    record.failed = value == "1";
+                              }
+                              else if (key == "fingerprint") {
+                                    record.fingerprint = std::stoull(value);
+                              }
+                              else if (key == "runs") {
+                                    record.runs = std::stoull(value);
+                              }
+                              else if (key == "flaky") {
+                                    record.flaky = std::stoull(value);
+                              }
+                              else if (key == "recent") {
+                                    record.recent = static_cast<std::uint32_t>(std::stoul(value));
+                              }
+                        }
+                        catch (const std::exception&) {
+                        }
+                  }
+
+                  std::map<std::string, HistoryRecord> records_;
+            };
+      }
+
+      namespace detail
+      {
+            /**
+             * @brief Read-only view of a whole file.
+             *        Memory-mapped where the platform allows it, read into
+             *        memory otherwise.
+             */
+            class MappedFile
+            {
+            public:
+                  explicit MappedFile(const std::string& path)
+                  {
+#if defined(UNIPP_HAS_MMAP)
+                        const int fd = ::open(path.c_str(), O_RDONLY);
+                        if (fd < 0) {
+                              return;
+                        }
+                        struct stat info;
+                        if (::fstat(fd, &info) == 0) {
+                              size_ = static_cast<std::size_t>(info.st_size);
+                              valid_ = true;
+                              if (size_ > 0) {
+                                    void* address = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                                    if (address == MAP_FAILED) {
+                                          valid_ = false;
+                                          size_ = 0;
+                                    }
+                                    else {
+                                          data_ = static_cast<const char*>(address);
+                                          mapped_ = true;
+                                    }
+                              }
+                        }
+                        ::close(fd);
+#else
+                        std::ifstream file(path, std::ios::binary);
+                        if (file) {
+                              fallback_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+                              data_ = fallback_.data();
+                              size_ = fallback_.size();
+                              valid_ = true;
+                        }
+#endif // UNIPP_HAS_MMAP
+                  }
+
+                  ~MappedFile()
+                  {
+#if defined(UNIPP_HAS_MMAP)
+                        if (mapped_) {
+                              ::munmap(const_cast<char*>(data_), size_);
+                        }
+#endif // UNIPP_HAS_MMAP
+                  }
+
+                  MappedFile(const MappedFile&) = delete;
+                  MappedFile& operator=(const MappedFile&) = delete;
+
+                  bool Valid() const { return valid_; }
+                  const char* Data() const { return data_ ? data_ : ""; }
+                  std::size_t Size() const { return size_; }
+
+            private:
+                  const char* data_ = nullptr;
+                  std::size_t size_ = 0;
+                  bool valid_ = false;
+                  bool mapped_ = false;
+                  std::string fallback_;
+            };
+
+            /** Fast non-cryptographic 64 bit hash, eight bytes at a time */
+            inline std::uint64_t Hash(const void* data, std::size_t size, std::uint64_t seed = 0)
+            {
+                  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+                  std::uint64_t hash = seed ^ (size * 0x9E3779B97F4A7C15ull);
+                  std::size_t i = 0;
+                  for (; i + 8 <= size; i += 8) {
+                        std::uint64_t word;
+                        std::memcpy(&word, bytes + i, sizeof(word));
+                        word *= 0xC2B2AE3D27D4EB4Full;
+                        hash ^= (word << 31) | (word >> 33);
+                        hash = ((hash << 27) | (hash >> 37)) * 0x9E3779B97F4A7C15ull + 0x165667B19E3779F9ull;
+                  }
+                  for (; i < size; i++) {
+                        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+                  }
+                  hash ^= hash >> 33;
+                  hash *= 0xFF51AFD7ED558CCDull;
+                  hash ^= hash >> 33;
+                  hash *= 0xC4CEB9FE1A85EC53ull;
+                  return hash ^ (hash >> 33);
+            }
+
+            /** Hash of a file's name and contents, 0 if it cannot be read. Memoized per run. */
+            inline std::uint64_t HashFile(const std::string& path)
+            {
+                  static std::mutex cache_mutex;
+                  static std::map<std::string, std::uint64_t> cache;
+                  {
+                        std::lock_guard<std::mutex> lock(cache_mutex);
+                        const auto entry = cache.find(path);
+                        if (entry != cache.end()) {
+                              return entry->second;
+                        }
+                  }
+
+                  std::uint64_t hash = 0;
+                  MappedFile file(path);
+                  if (file.Valid()) {
+                        hash = Hash(file.Data(), file.Size(), Hash(path.data(), path.size()));
+                        hash += hash == 0;
+                  }
+
+                  std::lock_guard<std::mutex> lock(cache_mutex);
+                  cache[path] = hash;
+                  return hash;
+            }
+
+            inline std::string ExecutablePath()
+            {
+#if defined(__linux__)
+                  return "/proc/self/exe";
+#elif defined(__APPLE__)
+                  char path[4096];
+                  uint32_t size = sizeof(path);
+                  return _NSGetExecutablePath(path, &size) == 0 ? std::string(path) : std::string();
+#else
+                  return "";
+#endif
+            }
+
+            /** Files a source file includes with #include "...", those found next to it */
+            inline std::vector<std::string> LocalIncludes(const std::string& path)
+            {
+                  std::vector<std::string> includes;
+                  MappedFile file(path);
+                  if (!file.Valid()) {
+                        return includes;
+                  }
+                  const std::string_view text(file.Data(), file.Size());
+                  const std::filesystem::path directory = std::filesystem::path(path).parent_path();
+                  for (std::size_t at = text.find("#include"); at != std::string_view::npos; at = text.find("#include", at + 1)) {
+                        const std::size_t open = text.find_first_not_of(" \t", at + 8);
+                        if (open == std::string_view::npos || text[open] != '"') {
+                              continue;
+                        }
+                        const std::size_t close = text.find_first_of("\"\n", open + 1);
+                        if (close == std::string_view::npos || text[close] != '"') {
+                              continue;
+                        }
+                        const std::filesystem::path include = (directory / std::string(text.substr(open + 1, close - open - 1))).lexically_normal();
+                        std::error_code error;
+                        if (std::filesystem::is_regular_file(include, error)) {
+                              includes.push_back(include.string());
+                        }
+                  }
+                  return includes;
+            }
+
+            /**
+             * @brief Hash of a source file and of what it includes with
+             *        #include "..." (found next to the including file, and so
+             *        on from there), 0 if the source cannot be read.
+             *        Memoized per run.
+             */
+            inline std::uint64_t HashSource(const std::string& path)
+            {
+                  static std::mutex cache_mutex;
+                  static std::map<std::string, std::uint64_t> cache;
+                  {
+                        std::lock_guard<std::mutex> lock(cache_mutex);
+                        const auto entry = cache.find(path);
+                        if (entry != cache.end()) {
+                              return entry->second;
+                        }
+                  }
+
+                  std::uint64_t hash = HashFile(path);
+                  if (hash != 0) {
+                        std::vector<std::string> seen{ std::filesystem::path(path).lexically_normal().string() };
+                        std::vector<std::string> pending = LocalIncludes(path);
+                        while (!pending.empty()) {
+                              const std::string include = pending.back();
+                              pending.pop_back();
+                              if (std::find(seen.begin(), seen.end(), include) != seen.end()) {
+                                    continue;
+                              }
+                              seen.push_back(include);
+                              const std::uint64_t file = HashFile(include);
+                              hash = Hash(&file, sizeof(file), hash);
+                              const std::vector<std::string> more = LocalIncludes(include);
+                              pending.insert(pending.end(), more.begin(), more.end());
+                        }
+                  }
+
+                  std::lock_guard<std::mutex> lock(cache_mutex);
+                  cache[path] = hash;
+                  return hash;
+            }
+
+            /**
+             * @brief Hash of everything a test depends on, 0 if unknown: the
+             *        source file that defines it along with the headers it
+             *        includes from next to it, and the inputs it lists (data
+             *        files, object files of the code under test). Editing
+             *        another test's file then reruns only that test's file.
+             *        When the source cannot be read (the binary is run from
+             *        elsewhere than it was built, or the test was made
+             *        without the macros) and the test lists no inputs, the
+             *        whole test binary stands in for it.
+             */
+            inline std::uint64_t Fingerprint(const std::string& full_name, const std::string& source, const std::vector<std::string>& inputs)
+            {
+                  std::uint64_t hash = Hash(full_name.data(), full_name.size());
+                  const std::uint64_t code = source.empty() ? 0 : HashSource(source);
+                  if (code != 0) {
+                        hash = Hash(&code, sizeof(code), hash);
+                  }
+                  else if (inputs.empty()) {
+                        const std::string executable = ExecutablePath();
+                        const std::uint64_t binary = executable.empty() ? 0 : HashFile(executable);
+                        return binary == 0 ? 0 : Hash(&binary, sizeof(binary), hash);
+                  }
+                  for (const auto& input : inputs) {
+                        const std::uint64_t file = HashFile(input);
+                        if (file == 0) {
+                              return 0;
+                        }
+                        hash = Hash(&file, sizeof(file), hash);
+                  }
+                  return hash;
+            }
+      }
+
+      /** Randomness */
+
+      /**
+       * @brief Small, fast, seedable random number generator (splitmix64).
+       */
+      class Random
+      {
+      public:
+            explicit Random(std::uint64_t seed) : state_(seed) {}
+
+            std::uint64_t Next()
+            {
+                  std::uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+                  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+                  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+                  return z ^ (z >> 31);
+            }
+
+            /** Uniform in [0, bound), 0 if bound is 0 */
+            std::uint64_t Below(std::uint64_t bound)
+            {
+                  return bound == 0 ? 0 : Next() % bound;
+            }
+
+            /** Uniform in [low, high] */
+            template<typename T>
+            T Between(T low, T high)
+            {
+                  const std::uint64_t span = static_cast<std::uint64_t>(high) - static_cast<std::uint64_t>(low);
+                  const std::uint64_t offset = span == std::numeric_limits<std::uint64_t>::max() ? Next() : Below(span + 1);
+                  return static_cast<T>(static_cast<std::uint64_t>(low) + offset);
+            }
+
+            /** Uniform in [0, 1) */
+            double Uniform()
+            {
+                  return static_cast<double>(Next() >> 11) * 0x1.0p-53;
+            }
+
+      private:
+            std::uint64_t state_;
+      };
+
+      namespace detail
+      {
+            inline std::uint64_t MixSeed(std::uint64_t seed, std::uint64_t index)
+            {
+                  return Random(seed ^ (index * 0xD1B54A32D192ED03ull)).Next();
+            }
+
+            inline std::uint64_t FreshSeed()
+            {
+                  static std::atomic<std::uint64_t> counter{0};
+                  const auto now = static_cast<std::uint64_t>(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+                  return MixSeed(now, counter++) | 1;
+            }
+      }
+
+      namespace detail
+      {
+            /** Glob match with * (any run of characters) and ? (any one character) */
+            inline bool GlobMatch(const char* pattern, const char* text)
+            {
+                  const char* star = nullptr;
+                  const char* resume = nullptr;
+                  while (*text) {
+                        if (*pattern == '?' || (*pattern != '*' && *pattern == *text)) {
+                              pattern++;
+                              text++;
+                        }
+                        else if (*pattern == '*') {
+                              star = pattern++;
+                              resume = text;
+                        }
+                        else if (star) {
+                              pattern = star + 1;
+                              text = ++resume;
+                        }
+                        else {
+                              return false;
+                        }
+                  }
+                  while (*pattern == '*') {
+                        pattern++;
+                  }
+                  return *pattern == '\0';
+            }
+
+            /** Whether --filter selects a test, by its own or its full name */
+            inline bool Selected(const std::string& suite, const std::string& name)
+            {
+                  const std::string& filter = GetOptions().filter;
+                  if (filter.empty()) {
+                        return true;
+                  }
+                  const std::string full_name = FullName(suite, name);
+                  std::stringstream globs(filter);
+                  std::string glob;
+                  while (std::getline(globs, glob, ',')) {
+                        if (GlobMatch(glob.c_str(), full_name.c_str()) || GlobMatch(glob.c_str(), name.c_str())) {
+                              return true;
+                        }
+                  }
+                  return false;
+            }
+
+            inline bool Stressing()
+            {
+                  return GetOptions().repeat > 1 || GetOptions().threads > 1;
+            }
+
+            /**
+             * @brief Wraps a test body for --repeat and --threads.
+             *        Every iteration runs the body on each thread at once,
+             *        each starting after a random delay of up to --jitter
+             *        drawn from the run's seed, to shake out races. The run
+             *        stops at the first failing iteration, or when the test's
+             *        time is almost up.
+             */
+            inline TestFunction Stressed(TestFunction body)
+            {
+                  return [body]() {
+                        const Options& options = GetOptions();
+                        const std::size_t repeat = options.repeat;
+                        const unsigned threads = options.threads;
+                        const auto jitter = threads > 1 ? options.jitter : std::chrono::microseconds(0);
+                        const std::uint64_t seed = options.seed != 0 ? options.seed : FreshSeed();
+                        TestContext& context = *CurrentContext();
+
+                        // Helpers wait for the iteration number to change, run their share and check in
+                        struct Team
+                        {
+                              std::atomic<std::size_t> iteration{0};
+                              std::atomic<unsigned> finished{0};
+                              std::atomic<bool> stop{false};
+                        } team;
+
+                        auto run_share = [&](unsigned thread, std::size_t iteration) {
+                              if (jitter.count() > 0) {
+                                    Random random(MixSeed(seed, iteration * threads + thread));
+                                    const auto start = std::chrono::steady_clock::now()
+                                          + std::chrono::microseconds(random.Below(static_cast<std::uint64_t>(jitter.count()) + 1));
+                                    while (std::chrono::steady_clock::now() < start) {
+                                    }
+                              }
+                              Invoke(body, context);
+                        };
+
+                        std::vector<std::thread> helpers;
+                        for (unsigned thread = 1; thread < threads; thread++) {
+                              helpers.emplace_back([&, thread]() {
+                                    for (std::size_t seen = 0;;) {
+                                          std::size_t iteration;
+                                          while ((iteration = team.iteration.load()) == seen) {
+                                                std::this_thread::yield();
+                                          }
+                                          seen = iteration;
+                                          if (team.stop) {
+                                                return;
+                                          }
+                                          run_share(thread, iteration);
+                                          team.finished++;
+                                    }
+                              });
+                        }
+
+                        context.quiet = true;
+                        std::size_t iteration = 1;
+                        bool failed = false;
+                        bool out_of_time = false;
+                        for (; iteration <= repeat; iteration++) {
+                              if (std::chrono::steady_clock::now() >= context.deadline) {
+                                    out_of_time = true;
+                                    break;
+                              }
+                              team.finished = 0;
+                              team.iteration = iteration;
+                              run_share(0, iteration);
+                              while (team.finished.load() != threads - 1) {
+                                    std::this_thread::yield();
+                              }
+                              if (Failed()) {
+                                    failed = true;
+                                    break;
+                              }
+                        }
+                        team.stop = true;
+                        team.iteration = repeat + 1;
+                        for (auto& helper : helpers) {
+                              helper.join();
+                        }
+                        context.quiet = false;
+
+                        const std::string threading = threads > 1 ? " on " + std::to_string(threads) + " threads" : "";
+                        if (failed) {
+                              {
+                                    std::lock_guard<std::mutex> lock(context.mutex);
+                                    context.message += " (iteration " + std::to_string(iteration) + " of " + std::to_string(repeat)
+                                          + threading + ", seed " + std::to_string(seed) + ")";
+                              }
+                              context.out << "      [+] Failed in iteration " << iteration << " of " << repeat << threading
+                                          << ", rerun with --seed=" << seed << std::endl;
+                        }
+                        else if (out_of_time) {
+                              context.out << "      [!] WARNING: Ran out of time after " << iteration - 1 << " of " << repeat
+                                          << " iterations" << threading << std::endl;
+                        }
+                        else {
+                              context.out << "      [√] PASSED " << repeat << " iterations" << threading << std::endl << std::endl;
+                        }
+                  };
+            }
+      }
+
+#if defined(UNIPP_HAS_COROUTINES)
+      /** Asynchronous tests */
+
+      /**
+       * @brief Drives the coroutines of async tests.
+       *        Every thread running async tests has a loop of its own, the
+       *        built-in one is epoll based. Bring your own with
+       *        unipp::UseEventLoop to run tests on the loop of your
+       *        networking library.
+       */
+      class EventLoop
+      {
+      public:
+            virtual ~EventLoop() = default;
+
+            /** Resumes the coroutine on the next turn of the loop */
+            virtual void Post(std::coroutine_handle<> coroutine) = 0;
+
+            /** Resumes the coroutine once the time comes */
+            virtual void PostAt(std::chrono::steady_clock::time_point when, std::coroutine_handle<> coroutine) = 0;
+
+            /** Resumes the coroutine once fd is readable (or writable) */
+            virtual void PostWhenReady(int fd, bool write, std::coroutine_handle<> coroutine) = 0;
+
+            /** Forgets a posted coroutine, which is about to be destroyed */
+            virtual void Cancel(std::coroutine_handle<> coroutine) = 0;
+
+            /** Resumes whatever is ready, waiting at most max_wait for something to be */
+            virtual void RunOnce(std::chrono::milliseconds max_wait) = 0;
+      };
+
+#if defined(UNIPP_HAS_EPOLL)
+      /**
+       * @brief The built-in event loop: a ready queue, a timer queue and an
+       *        epoll set, all used from a single thread.
+       */
+      class EpollLoop : public EventLoop
+      {
+      public:
+            EpollLoop() : epoll_(::epoll_create1(EPOLL_CLOEXEC))
+            {
+                  if (epoll_ < 0) {
+                        throw std::runtime_error("epoll_create1 failed");
+                  }
+            }
+
+            ~EpollLoop() override
+            {
+                  ::close(epoll_);
+            }
+
+            EpollLoop(const EpollLoop&) = delete;
+            EpollLoop& operator=(const EpollLoop&) = delete;
+
+            void Post(std::coroutine_handle<> coroutine) override
+            {
+                  ready_.push_back(coroutine);
+            }
+
+            void PostAt(std::chrono::steady_clock::time_point when, std::coroutine_handle<> coroutine) override
+            {
+                  timers_.emplace(when, coroutine);
+            }
+
+            void PostWhenReady(int fd, bool write, std::coroutine_handle<> coroutine) override
+            {
+                  Watch& watch = watches_[fd];
+                  const bool added = !watch.reader && !watch.writer;
+                  (write ? watch.writer : watch.reader) = coroutine;
+                  if (!Update(fd, watch, added)) {
+                        // Not pollable (regular files are always ready)
+                        (write ? watch.writer : watch.reader) = nullptr;
+                        if (added) {
+                              watches_.erase(fd);
+                        }
+                        Post(coroutine);
+                  }
+            }
+
+            void Cancel(std::coroutine_handle<> coroutine) override
+            {
+                  ready_.erase(std::remove(ready_.begin(), ready_.end(), coroutine), ready_.end());
+                  for (auto timer = timers_.begin(); timer != timers_.end();) {
+                        timer = timer->second == coroutine ? timers_.erase(timer) : std::next(timer);
+                  }
+                  for (auto watch = watches_.begin(); watch != watches_.end();) {
+                        if (watch->second.reader == coroutine || watch->second.writer == coroutine) {
+                              watch->second.reader = watch->second.reader == coroutine ? nullptr : watch->second.reader;
+                              watch->second.writer = watch->second.writer == coroutine ? nullptr : watch->second.writer;
+                              if (Forget(watch)) {
+                                    continue;
+                              }
+                        }
+                        ++watch;
+                  }
+            }
+
+            void RunOnce(std::chrono::milliseconds max_wait) override
+            {
+                  long long timeout = ready_.empty() ? std::max<long long>(0, max_wait.count()) : 0;
+                  if (!timers_.empty()) {
+                        const auto until = std::chrono::ceil<std::chrono::milliseconds>(timers_.begin()->first - std::chrono::steady_clock::now());
+                        timeout = std::min<long long>(timeout, std::max<long long>(0, until.count()));
+                  }
+
+                  epoll_event events[64];
+                  const int count = ::epoll_wait(epoll_, events, 64, static_cast<int>(timeout));
+                  for (int i = 0; i < count; i++) {
+                        auto watch = watches_.find(events[i].data.fd);
+                        if (watch == watches_.end()) {
+                              continue;
+                        }
+                        const std::uint32_t happened = events[i].events;
+                        if (watch->second.reader && (happened & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+                              ready_.push_back(watch->second.reader);
+                              watch->second.reader = nullptr;
+                        }
+                        if (watch->second.writer && (happened & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                              ready_.push_back(watch->second.writer);
+                              watch->second.writer = nullptr;
+                        }
+                        Forget(watch);
+                  }
+
+                  const auto now = std::chrono::steady_clock::now();
+                  while (!timers_.empty() && timers_.begin()->first <= now) {
+                        ready_.push_back(timers_.begin()->second);
+                        timers_.erase(timers_.begin());
+                  }
+
+                  std::deque<std::coroutine_handle<>> batch;
+                  batch.swap(ready_);
+                  for (auto coroutine : batch) {
+                        coroutine.resume();
+                  }
+            }
+
+      private:
+            struct Watch
+            {
+                  std::coroutine_handle<> reader;
+                  std::coroutine_handle<> writer;
+            };
+
+            bool Update(int fd, const Watch& watch, bool added)
+            {
+                  epoll_event event{};
+                  event.events = (watch.reader ? EPOLLIN : 0u) | (watch.writer ? EPOLLOUT : 0u);
+                  event.data.fd = fd;
+                  return ::epoll_ctl(epoll_, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event) == 0;
+            }
+
+            /** Stops watching a descriptor nobody waits on anymore, true if it did */
+            bool Forget(std::map<int, Watch>::iterator& watch)
+            {
+                  if (watch->second.reader || watch->second.writer) {
+                        Update(watch->first, watch->second, false);
+                        return false;
+                  }
+                  ::epoll_ctl(epoll_, EPOLL_CTL_DEL, watch->first, nullptr);
+                  watch = watches_.erase(watch);
+                  return true;
+            }
+
+            int epoll_;
+            std::deque<std::coroutine_handle<>> ready_;
+            std::multimap<std::chrono::steady_clock::time_point, std::coroutine_handle<>> timers_;
+            std::map<int, Watch> watches_;
+      };
+#endif // UNIPP_HAS_EPOLL
+
+      typedef std::function<std::unique_ptr<EventLoop>()> EventLoopFactory;
+
+      namespace detail
+      {
+            inline EventLoopFactory& LoopFactory()
+            {
+#if defined(UNIPP_HAS_EPOLL)
+                  static EventLoopFactory factory = []() -> std::unique_ptr<EventLoop> { return std::make_unique<EpollLoop>(); };
+#else
+                  static EventLoopFactory factory;
+#endif // UNIPP_HAS_EPOLL
+                  return factory;
+            }
+
+            inline std::unique_ptr<EventLoop> MakeEventLoop()
+            {
+                  if (!LoopFactory()) {
+                        throw std::runtime_error("No event loop for async tests, see unipp::UseEventLoop");
+                  }
+                  return LoopFactory()();
+            }
+
+            /** The loop driving the async tests of this thread */
+            inline EventLoop*& CurrentLoop()
+            {
+                  static thread_local EventLoop* loop = nullptr;
+                  return loop;
+            }
+
+            /** An async test in flight, and where it is suspended */
+            struct AsyncTest
+            {
+                  TestContext* context = nullptr;
+                  std::coroutine_handle<> waiting;
+            };
+
+            inline AsyncTest*& CurrentAsyncTest()
+            {
+                  static thread_local AsyncTest* test = nullptr;
+                  return test;
+            }
+
+            /**
+             * @brief Makes an async test the current one of this thread, so
+             *        its assertions report to it. Tests take turns on the
+             *        loop, so this happens every time one resumes.
+             */
+            inline void Resume(AsyncTest* test)
+            {
+                  CurrentAsyncTest() = test;
+                  CurrentContext() = test ? test->context : nullptr;
+            }
+
+            template<typename Post>
+            struct LoopAwaiter
+            {
+                  Post post;
+                  AsyncTest* test = nullptr;
+
+                  bool await_ready() const noexcept { return false; }
+
+                  void await_suspend(std::coroutine_handle<> coroutine)
+                  {
+                        EventLoop* loop = CurrentLoop();
+                        if (!loop) {
+                              throw std::logic_error("Awaited the event loop outside of an async test");
+                        }
+                        test = CurrentAsyncTest();
+                        if (test) {
+                              test->waiting = coroutine;
+                        }
+                        post(*loop, coroutine);
+                  }
+
+                  void await_resume() { Resume(test); }
+            };
+
+            template<typename Post>
+            LoopAwaiter<Post> MakeAwaiter(Post post)
+            {
+                  return LoopAwaiter<Post>{ post };
+            }
+      }
+
+      /**
+       * @brief Has async tests run on a loop of your own, instead of the
+       *        built-in one. The factory is called once per thread.
+       */
+      inline void UseEventLoop(EventLoopFactory factory)
+      {
+            detail::LoopFactory() = factory;
+      }
+
+      /** co_await Readable(fd): resumes once fd can be read without blocking */
+      inline auto Readable(int fd)
+      {
+            return detail::MakeAwaiter([fd](EventLoop& loop, std::coroutine_handle<> coroutine) { loop.PostWhenReady(fd, false, coroutine); });
+      }
+
+      /** co_await Writable(fd): resumes once fd can be written without blocking */
+      inline auto Writable(int fd)
+      {
+            return detail::MakeAwaiter([fd](EventLoop& loop, std::coroutine_handle<> coroutine) { loop.PostWhenReady(fd, true, coroutine); });
+      }
+
+      /** co_await Sleep(MILLISECONDS(10)): lets the other tests run meanwhile */
+      inline auto Sleep(std::chrono::steady_clock::duration duration)
+      {
+            const auto when = std::chrono::steady_clock::now() + duration;
+            return detail::MakeAwaiter([when](EventLoop& loop, std::coroutine_handle<> coroutine) { loop.PostAt(when, coroutine); });
+      }
+
+      /** co_await Yield(): lets the other tests run */
+      inline auto Yield()
+      {
+            return detail::MakeAwaiter([](EventLoop& loop, std::coroutine_handle<> coroutine) { loop.Post(coroutine); });
+      }
+
+      /**
+       * @brief Coroutine type of async test bodies, and of the coroutines
+       *        they co_await.
+       *
+       *        TEST("Echo", "Round trips a message", []() -> unipp::Task {
+       *              co_await unipp::Writable(fd);
+       *              ...
+       *              co_await unipp::Readable(fd);
+       *              CO_ASSERT_EQUAL(reply, message, "Expected the message back");
+       *        })
+       */
+      class Task
+      {
+      public:
+            struct promise_type
+            {
+                  std::coroutine_handle<> continuation;
+                  std::exception_ptr exception;
+                  std::function<void()> on_done;
+
+                  struct Final
+                  {
+                        bool await_ready() const noexcept { return false; }
+
+                        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> self) noexcept
+                        {
+                              promise_type& promise = self.promise();
+                              if (promise.continuation) {
+                                    return promise.continuation;
+                              }
+                              if (promise.on_done) {
+                                    promise.on_done();
+                              }
+                              return std::noop_coroutine();
+                        }
+
+                        void await_resume() const noexcept {}
+                  };
+
+                  Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+                  std::suspend_always initial_suspend() const noexcept { return {}; }
+                  Final final_suspend() const noexcept { return {}; }
+                  void return_void() {}
+                  void unhandled_exception() { exception = std::current_exception(); }
+            };
+
+            Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+            Task& operator=(Task&& other) noexcept
+            {
+                  if (this != &other) {
+                        if (handle_) {
+                              handle_.destroy();
+                        }
+                        handle_ = std::exchange(other.handle_, nullptr);
+                  }
+                  return *this;
+            }
+
+            ~Task()
+            {
+                  if (handle_) {
+                        handle_.destroy();
+                  }
+            }
+
+            bool await_ready() const noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+            {
+                  handle_.promise().continuation = caller;
+                  return handle_;
+            }
+
+            void await_resume() const
+            {
+                  if (handle_.promise().exception) {
+                        std::rethrow_exception(handle_.promise().exception);
+                  }
+            }
+
+            std::coroutine_handle<promise_type> Handle() const { return handle_; }
+
+      private:
+            explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+            std::coroutine_handle<promise_type> handle_;
+      };
+
+      typedef std::function<Task()> AsyncFunction;
+
+      namespace detail
+      {
+            /** Starts an async test, running it up to its first suspension */
+            inline std::unique_ptr<Task> Start(const AsyncFunction& body, AsyncTest& test, std::function<void()> on_done)
+            {
+                  Resume(&test);
+                  auto task = std::make_unique<Task>(body());
+                  task->Handle().promise().on_done = on_done;
+                  task->Handle().resume();
+                  return task;
+            }
+
+            /**
+             * @brief Runs an async test body to completion on a loop of its
+             *        own, for when it runs like any other test.
+             */
+            inline void RunToCompletion(const AsyncFunction& body)
+            {
+                  std::unique_ptr<EventLoop> loop = MakeEventLoop();
+                  EventLoop* previous_loop = CurrentLoop();
+                  AsyncTest* previous = CurrentAsyncTest();
+                  CurrentLoop() = loop.get();
+
+                  AsyncTest test;
+                  test.context = CurrentContext();
+                  bool done = false;
+                  std::unique_ptr<Task> task = Start(body, test, [&done]() { done = true; });
+                  while (!done) {
+                        loop->RunOnce(std::chrono::milliseconds(100));
+                  }
+                  Resume(previous);
+                  CurrentContext() = test.context;
+                  CurrentLoop() = previous_loop;
+
+                  if (task->Handle().promise().exception) {
+                        std::rethrow_exception(task->Handle().promise().exception);
+                  }
+            }
+
+            /** Body of WithHooks for async tests, taking its arguments by value so they live in the coroutine */
+            inline Task Hooked(AsyncFunction body, TestFunction before, TestFunction after)
+            {
+                  std::exception_ptr error;
+                  try {
+                        if (before) {
+                              before();
+                        }
+                        if (!Failed()) {
+                              co_await body();
+                        }
+                  }
+                  catch (...) {
+                        error = std::current_exception();
+                  }
+                  if (after) {
+                        after();
+                  }
+                  if (error) {
+                        std::rethrow_exception(error);
+                  }
+            }
+
+            /** Same as WithHooks, for the body of an async test */
+            inline AsyncFunction WithHooks(AsyncFunction body, TestFunction before, TestFunction after)
+            {
+                  return [body, before, after]() { return Hooked(body, before, after); };
+            }
+      }
+#endif // UNIPP_HAS_COROUTINES
+
+      /** Tag of tests that must never be skipped by --incremental */
+      inline const char* const kNondeterministic = "nondeterministic";
+
+      /**
+       * @brief Defines a unit test
+       *
+       *        TEST("My Test", "This is a test description", []() { ... }).Timeout(MILLISECONDS(500))
+       */
+      struct UnitTest
+      {
+            std::string name;         
+            std::string description;
+            TestFunction test;
+            std::chrono::milliseconds timeout{0};
+            std::vector<std::string> tags;
+            std::vector<std::string> inputs;
+            std::string source;
+#if defined(UNIPP_HAS_COROUTINES)
+            AsyncFunction async;
+#endif // UNIPP_HAS_COROUTINES
+
+            UnitTest(std::string name, std::string description, TestFunction test)
+                  : name(name), description(description), test(test) {}
+
+#if defined(UNIPP_HAS_COROUTINES)
+            /**
+             * @brief Defines an async test, whose body is a coroutine returning
+             *        unipp::Task. RUN multiplexes async tests on event loops,
+             *        run on their own they get a loop to themselves.
+             */
+            template<typename Body, typename std::enable_if<std::is_same<std::invoke_result_t<Body&>, Task>::value, int>::type = 0>
+            UnitTest(std::string name, std::string description, Body body)
+                  : name(name), description(description), async(body)
+            {
+                  AsyncFunction coroutine = async;
+                  test = [coroutine]() { detail::RunToCompletion(coroutine); };
+            }
+#endif // UNIPP_HAS_COROUTINES
+
+            /**
+             * @brief Tags the test, e.g. .Tags({ unipp::kNondeterministic }).
+             */
+            UnitTest& Tags(std::vector<std::string> list)
+            {
+                  tags.insert(tags.end(), list.begin(), list.end());
+                  return *this;
+            }
+
+            bool HasTag(const std::string& tag) const
+            {
+                  return std::find(tags.begin(), tags.end(), tag) != tags.end();
+            }
+
+            /**
+             * @brief Lists the files the test depends on besides its source
+             *        file (data files, the object files of the code under
+             *        test...). With --incremental the test is skipped while
+             *        these and its source are unchanged.
+             */
+            UnitTest& Inputs(std::vector<std::string> paths)
+            {
+                  inputs.insert(inputs.end(), paths.begin(), paths.end());
+                  return *this;
+            }
+
+            /**
+             * @brief Sets the source file that defines the test, which the
+             *        test macros do with __FILE__. See detail::Fingerprint.
+             */
+            UnitTest& Source(std::string path)
+            {
+                  source = std::move(path);
+                  return *this;
+            }
+
+            /**
+             * @brief Sets the time limit for this test, overriding --timeout.
+             */
+            UnitTest& Timeout(std::chrono::milliseconds limit)
+            {
+                  timeout = limit;
+                  return *this;
+            }
+
+            /**
+             * @brief Runs the test
+             *
+             * @param suite Name of the suite the test belongs to
+             * @param budget Time left in the suite's budget (0 = unlimited)
+             * @param echo Print the output as it happens. Otherwise it is only
+             *             collected in the result, under the test's full name,
+             *             for the runner to print in one piece.
+             * @return TestResult
+             */
+            TestResult Run(const std::string& suite = "", std::chrono::milliseconds budget = std::chrono::milliseconds(0), bool echo = true) const
+            {
+                  auto context = std::make_shared<detail::TestContext>(echo);
+                  context->out << "   [TEST] Running test: " << (echo ? name : detail::FullName(suite, name)) << std::endl;
+                  context->out << "   [+] Description: " << description << std::endl;
+
+                  std::chrono::milliseconds limit = timeout.count() > 0 ? timeout : GetOptions().timeout;
+                  if (budget.count() > 0 && (limit.count() <= 0 || budget < limit)) {
+                        limit = budget;
+                  }
+
+                  TestResult result;
+                  result.suite = suite;
+                  result.name = name;
+
+                  const auto start = std::chrono::steady_clock::now();
+                  if (limit.count() > 0) {
+                        context->deadline = start + limit - std::min(limit / 10, std::chrono::milliseconds(100));
+                  }
+                  const bool finished = detail::Execute(detail::Stressing() ? detail::Stressed(test) : test, context, limit);
+                  result.duration = std::chrono::steady_clock::now() - start;
+
+                  if (!finished) {
+                        result.status = TestStatus::TimedOut;
+                        result.message = "Timed out after " + detail::FormatMilliseconds(limit);
+                        context->out << "      [X] TIMED OUT: " << result.message << std::endl;
+                        context->out << "      [+] Stacks:" << std::endl << detail::CaptureStacks() << std::endl;
+                  }
+                  else {
+                        std::lock_guard<std::mutex> lock(context->mutex);
+                        if (context->failed) {
+                              result.status = TestStatus::Failed;
+                              result.message = context->message;
+                        }
+                  }
+                  result.output = context->capture.Text();
+                  return result;
+            }
+      };
+
+
+      namespace detail
+      {
+            /** Whether the test has a coroutine body, which the runner multiplexes */
+            inline bool IsAsync(const UnitTest& test)
+            {
+#if defined(UNIPP_HAS_COROUTINES)
+                  return static_cast<bool>(test.async);
+#else
+                  (void)test;
+                  return false;
+#endif // UNIPP_HAS_COROUTINES
+            }
+      }
+
+
+      /** Typed tests */
+
+      /** A list of types to instantiate a typed test with */
+      template<typename... T>
+      struct Types {};
+
+      /** Tag a typed test body is called with, its type is the one to test */
+      template<typename T>
+      struct Type
+      {
+            typedef T type;
+      };
+
+      namespace detail
+      {
+            /** Readable name of T, taken from the compiler's name for this function */
+            template<typename T>
+            inline std::string TypeName()
+            {
+#if defined(_MSC_VER)
+                  const std::string_view signature = __FUNCSIG__;
+                  const std::size_t begin = signature.find("TypeName<") + std::strlen("TypeName<");
+                  const std::size_t end = signature.rfind(">(void)");
+#else
+                  const std::string_view signature = __PRETTY_FUNCTION__;
+                  const std::size_t begin = signature.find("T = ") + std::strlen("T = ");
+                  const std::size_t separator = signature.find("; ", begin);
+                  const std::size_t end = separator != std::string_view::npos ? separator : signature.rfind(']');
+#endif // _MSC_VER
+                  return std::string(signature.substr(begin, end - begin));
+            }
+      }
+
+      /**
+       * @brief The tests a typed test expands to, one per type. They can go
+       *        anywhere tests can, and take the same settings as a test.
+       */
+      struct TypedTests
+      {
+            std::vector<UnitTest> tests;
+
+            TypedTests& Tags(std::vector<std::string> list)
+            {
+                  for (auto& test : tests) {
+                        test.Tags(list);
+                  }
+                  return *this;
+            }
+
+            TypedTests& Inputs(std::vector<std::string> paths)
+            {
+                  for (auto& test : tests) {
+                        test.Inputs(paths);
+                  }
+                  return *this;
+            }
+
+            TypedTests& Timeout(std::chrono::milliseconds limit)
+            {
+                  for (auto& test : tests) {
+                        test.Timeout(limit);
+                  }
+                  return *this;
+            }
+      };
+
+      /**
+       * @brief Defines a test once for several types: body is instantiated
+       *        for each type of the list, at compile time, and each becomes
+       *        a test of its own named after it, e.g. "Push<int>", to be
+       *        filtered and run in parallel like any other.
+       *
+       *        TYPED_TEST("Push", "Push grows the stack", unipp::Types<int, std::string>(), [](auto type) {
+       *              using T = typename decltype(type)::type;
+       *              Stack<T> stack;
+       *              stack.Push(T());
+       *              ASSERT_EQUAL(stack.Size(), 1u, "Size after Push");
+       *        })
+       */
+      template<typename... T, typename Body>
+      inline TypedTests Typed(std::string name, std::string description, Types<T...>, Body body)
+      {
+            return TypedTests{ { UnitTest(name + "<" + detail::TypeName<T>() + ">", description, [body]() { body(Type<T>()); })... } };
+      }
+
+
+      /** Classes */
+      class TestSuite
+      {
+      public:
+            /**
+             * @brief Construct a new Test Suite object
+             *
+             *        SUITE("My Suite", "This is a suite description",
+             *              TEST("My Test", "This is a test description", []() { ... }),
+             *              TEST("My Test 2", "This is a test description", []() { ... }),
+             *              TEST("My Test 3", "This is a test description", []() { ... })
+             *        ).Timeout(SECONDS(30));
+             *
+             * @tparam Tests
+             * @param name
+             * @param description
+             * @param tests
+             */
+            template<typename... Tests>
+            TestSuite(std::string name, std::string description, Tests... tests)
+                      : name_(name), description_(description), fixture_(std::make_shared<Fixture>())
+            {
+                  AddTests(tests...);
+            }
+
+
+            /**
+             * @brief Adds tests to the suite.
+             */
+            template<typename... Tests>
+            void AddTests(Tests... tests)
+            {
+                  (Add(tests), ...);
+            }
+
+
+            /**
+             * @brief Keeps only the tests for which keep(test) is true.
+             */
+            template<typename Predicate>
+            void Select(Predicate keep)
+            {
+                  tests_.erase(std::remove_if(tests_.begin(), tests_.end(), [&keep](const UnitTest& test) { return !keep(test); }), tests_.end());
+            }
+
+
+            /**
+             * @brief Sets a time budget for the whole suite.
+             *        Each test is limited to what is left of it, and once it
+             *        is spent the remaining tests are reported as timed out.
+             */
+            TestSuite& Timeout(std::chrono::milliseconds budget)
+            {
+                  timeout_ = budget;
+                  return *this;
+            }
+
+
+            /**
+             * @brief Sets up state shared by every test in the suite, such as
+             *        a database loaded from disk. It runs once, right before
+             *        the first of the suite's tests that actually runs (never
+             *        if they are all cached), and tests running in parallel
+             *        share what it built. If it fails, so do the suite's tests.
+             *
+             *        std::unique_ptr<Database> db;
+             *        SUITE("Queries", "...", TEST(...), TEST(...))
+             *              .Setup([&]() { db = std::make_unique<Database>("fixtures.db"); })
+             *              .Teardown([&]() { db.reset(); })
+             */
+            TestSuite& Setup(TestFunction setup)
+            {
+                  setup_ = setup;
+                  return *this;
+            }
+
+            /**
+             * @brief Undoes Setup once the last of the suite's tests is done.
+             */
+            TestSuite& Teardown(TestFunction teardown)
+            {
+                  teardown_ = teardown;
+                  return *this;
+            }
+
+            /**
+             * @brief Runs before each test of the suite, within the test, so
+             *        it shares the test's time limit and failing it fails the
+             *        test (whose body is then skipped).
+             */
+            TestSuite& BeforeEach(TestFunction before)
+            {
+                  before_each_ = before;
+                  return *this;
+            }
+
+            /**
+             * @brief Runs after each test of the suite, even if it failed.
+             */
+            TestSuite& AfterEach(TestFunction after)
+            {
+                  after_each_ = after;
+                  return *this;
+            }
+
+
+            /**
+             * @brief Run the tests in the suite.
+             *        Suites without a name hold the loose tests given to RUN
+             *        and print no header.
+             */
+            std::vector<TestResult> Run()
+            {
+                  std::vector<TestResult> results;
+                  Run([&results](const TestResult& result) { results.push_back(result); });
+                  return results;
+            }
+
+
+            /**
+             * @brief Run the tests in the suite, handing each result over as
+             *        soon as it is known.
+             */
+            template<typename Callback>
+            void Run(Callback on_result)
+            {
+                  Run(on_result, [this](const UnitTest& test, std::chrono::steady_clock::time_point deadline) {
+                        return RunTest(test, deadline, true);
+                  });
+            }
+
+
+            /**
+             * @brief Same as above, with the runner deciding how each test is
+             *        run: run_test(test, deadline) returns its TestResult.
+             *
+             * @return false if the suite's teardown failed
+             */
+            template<typename Callback, typename Runner>
+            bool Run(Callback on_result, Runner run_test)
+            {
+                  return Run(on_result, run_test, [&on_result, &run_test](const std::vector<const UnitTest*>& tests,
+                                                                          std::chrono::steady_clock::time_point deadline) {
+                        for (const UnitTest* test : tests) {
+                              on_result(run_test(*test, deadline));
+                        }
+                  });
+            }
+
+
+            /**
+             * @brief Same as above, with the suite's async tests going first,
+             *        all handed to run_async(tests, deadline) at once so the
+             *        runner can multiplex them. It reports their results.
+             *
+             * @return false if the suite's teardown failed
+             */
+            template<typename Callback, typename Runner, typename AsyncRunner>
+            bool Run(Callback on_result, Runner run_test, AsyncRunner run_async)
+            {
+                  const bool header = !name_.empty();
+                  if (header) {
+                        std::cout << "[SUITE | " << this->name_ << " | " << this->description_ << "]" << std::endl;
+                  }
+
+                  const auto deadline = std::chrono::steady_clock::now() + timeout_;
+                  std::vector<const UnitTest*> async;
+                  for (const auto& test : tests_) {
+                        if (detail::IsAsync(test)) {
+                              async.push_back(&test);
+                        }
+                  }
+                  if (!async.empty()) {
+                        run_async(async, deadline);
+                  }
+                  for (const auto& test : tests_) {
+                        if (!detail::IsAsync(test)) {
+                              on_result(run_test(test, deadline));
+                        }
+                  }
+                  std::string output;
+                  const bool torn_down = TearDown(true, output);
+
+                  if (header) {
+                        std::cout << "[END SUITE]" << std::endl << std::endl;
+                  }
+                  return torn_down;
+            }
+
+
+            /**
+             * @brief Runs the suite's teardown if its setup ran, leaving the
+             *        suite ready to be set up again. Call it once none of its
+             *        tests are running anymore.
+             *
+             * @return false if the teardown failed
+             */
+            bool TearDown(bool echo, std::string& output)
+            {
+                  output.clear();
+                  if (!fixture_->ran) {
+                        return true;
+                  }
+                  fixture_ = std::make_shared<Fixture>();
+                  if (!teardown_) {
+                        return true;
+                  }
+                  return detail::RunHook(teardown_, "   [TEARDOWN] Suite: " + name_, echo, output).empty();
+            }
+
+
+            /**
+             * @brief Runs one of the suite's tests within what is left of the
+             *        suite's budget, given the time the budget runs out.
+             */
+            TestResult RunTest(const UnitTest& test, std::chrono::steady_clock::time_point deadline, bool echo) const
+            {
+                  std::string setup_output;
+                  const std::string error = SetUp(echo, setup_output);
+                  TestResult result = error.empty() ? RunBudgeted(test, deadline, echo)
+                                                    : Skip(test, TestStatus::Failed, "Suite setup failed: " + error, echo);
+                  result.output = setup_output + result.output;
+                  return result;
+            }
+
+
+            /**
+             * @brief Runs the suite's setup unless it already ran (or is
+             *        running on another thread, which is then waited for).
+             *
+             * @param output Output of the setup if this call ran it
+             * @return Why the setup failed, empty if it did not
+             */
+            std::string SetUp(bool echo, std::string& output) const
+            {
+                  output.clear();
+                  if (!setup_ && !teardown_) {
+                        return "";
+                  }
+                  Fixture& fixture = *fixture_;
+                  std::call_once(fixture.once, [&]() {
+                        fixture.ran = true;
+                        if (setup_) {
+                              fixture.error = detail::RunHook(setup_, "   [SETUP] Suite: " + name_, echo, output);
+                        }
+                  });
+                  return fixture.error;
+            }
+
+
+            /**
+             * @brief Reports one of the suite's tests without running it.
+             */
+            TestResult Skip(const UnitTest& test, TestStatus status, const std::string& message, bool echo) const
+            {
+                  TestResult result;
+                  result.suite = name_;
+                  result.name = test.name;
+                  result.status = status;
+                  result.message = message;
+                  result.output = "   [TEST] Skipping test: " + (echo ? test.name : detail::FullName(name_, test.name))
+                        + "\n      [X] " + (status == TestStatus::TimedOut ? "TIMED OUT" : "FAILED") + ": " + message + "\n";
+                  if (echo) {
+                        std::cout << result.output << std::flush;
+                  }
+                  return result;
+            }
+
+#if defined(UNIPP_HAS_COROUTINES)
+            /**
+             * @brief Body of one of the suite's async tests, wrapped with the
+             *        suite's per test hooks, for the runner to multiplex.
+             */
+            AsyncFunction AsyncBody(const UnitTest& test) const
+            {
+                  if (!before_each_ && !after_each_) {
+                        return test.async;
+                  }
+                  return detail::WithHooks(test.async, before_each_, after_each_);
+            }
+#endif // UNIPP_HAS_COROUTINES
+
+            const std::string& Name() const { return name_; }
+            const std::string& Description() const { return description_; }
+            const std::vector<UnitTest>& Tests() const { return tests_; }
+            std::chrono::milliseconds Budget() const { return timeout_; }
+
+      private:
+            /** What the suite's setup built, shared by the tests of one run */
+            struct Fixture
+            {
+                  std::once_flag once;
+                  bool ran = false;
+                  std::string error;
+            };
+
+            void Add(const UnitTest& test)
+            {
+                  tests_.push_back(test);
+            }
+
+            void Add(const TypedTests& typed)
+            {
+                  tests_.insert(tests_.end(), typed.tests.begin(), typed.tests.end());
+            }
+
+            TestResult RunBudgeted(const UnitTest& test, std::chrono::steady_clock::time_point deadline, bool echo) const
+            {
+                  std::chrono::milliseconds budget(0);
+                  if (timeout_.count() > 0) {
+                        budget = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                        if (budget.count() <= 0) {
+                              return Skip(test, TestStatus::TimedOut, "Suite exceeded its " + detail::FormatMilliseconds(timeout_) + " budget", echo);
+                        }
+                  }
+                  if (!before_each_ && !after_each_) {
+                        return test.Run(name_, budget, echo);
+                  }
+                  UnitTest hooked = test;
+                  hooked.test = detail::WithHooks(test.test, before_each_, after_each_);
+                  return hooked.Run(name_, budget, echo);
+            }
+
+            std::string name_;
+            std::string description_;
+            std::vector<UnitTest> tests_;
+            std::chrono::milliseconds timeout_{0};
+            TestFunction setup_;
+            TestFunction teardown_;
+            TestFunction before_each_;
+            TestFunction after_each_;
+            std::shared_ptr<Fixture> fixture_;
+      };
+
+
+      /** Reporters */
+
+      namespace detail
+      {
+            /** Escapes text for XML content and attributes, dropping characters XML 1.0 cannot hold */
+            inline std::string XmlEscape(const std::string& text)
+            {
+                  std::string xml;
+                  xml.reserve(text.size());
+                  for (const char c : text) {
+                        switch (c) {
+                              case '&': xml += "&amp;"; break;
+                              case '<': xml += "&lt;"; break;
+                              case '>': xml += "&gt;"; break;
+                              case '"': xml += "&quot;"; break;
+                              case '\'': xml += "&apos;"; break;
+                              default:
+                                    if (static_cast<unsigned char>(c) < 0x20 && c != '\t' && c != '\n' && c != '\r') {
+                                          xml += '?';
+                                    }
+                                    else {
+                                          xml += c;
+                                    }
+                        }
+                  }
+                  return xml;
+            }
+
+            inline std::string FormatSeconds(std::chrono::nanoseconds duration)
+            {
+                  char seconds[32];
+                  std::snprintf(seconds, sizeof(seconds), "%.3f", std::chrono::duration<double>(duration).count());
+                  return seconds;
+            }
+
+#if defined(UNIPP_HAS_FORK)
+            /** Stream buffer writing straight to a file descriptor */
+            class DescriptorBuffer : public std::streambuf
+            {
+            public:
+                  explicit DescriptorBuffer(int fd) : fd_(fd) {}
+
+            protected:
+                  int overflow(int c) override
+                  {
+                        if (c != traits_type::eof()) {
+                              const char character = static_cast<char>(c);
+                              if (xsputn(&character, 1) != 1) {
+                                    return traits_type::eof();
+                              }
+                        }
+                        return c;
+                  }
+
+                  std::streamsize xsputn(const char* data, std::streamsize size) override
+                  {
+                        std::streamsize written = 0;
+                        while (written < size) {
+                              const ssize_t count = ::write(fd_, data + written, static_cast<std::size_t>(size - written));
+                              if (count < 0 && errno == EINTR) {
+                                    continue;
+                              }
+                              if (count <= 0) {
+                                    break;
+                              }
+                              written += count;
+                        }
+                        return written;
+                  }
+
+            private:
+                  int fd_;
+            };
+#endif // UNIPP_HAS_FORK
+
+            /** Whether a report already took stdout over */
+            inline bool& StdoutClaimed()
+            {
+                  static bool claimed = false;
+                  return claimed;
+            }
+
+            /**
+             * @brief Writes results to a file (or stdout, for "-") as they come
+             *        in, flushing after each one. The runner calls Report
+             *        under its own lock, so results from parallel jobs are
+             *        never interleaved, and nothing is kept between calls.
+             *        A report on stdout has it to itself: while the reporter
+             *        lives, the console output goes to stderr.
+             */
+            class Reporter
+            {
+            public:
+                  explicit Reporter(const std::string& path)
+                  {
+                        if (path == "-") {
+                              ClaimStdout();
+                              return;
+                        }
+                        file_.open(path, std::ios::trunc);
+                        if (!file_) {
+                              std::cerr << "[!] Could not open report file " << path << std::endl;
+                        }
+                  }
+
+                  virtual ~Reporter()
+                  {
+                        if (!stdout_) {
+                              return;
+                        }
+                        stdout_->flush();
+                        std::cout.flush();
+#if defined(UNIPP_HAS_FORK)
+                        std::fflush(stdout);
+                        dup2(saved_stdout_, STDOUT_FILENO);
+                        close(saved_stdout_);
+#else
+                        std::cout.rdbuf(console_);
+#endif // UNIPP_HAS_FORK
+                        StdoutClaimed() = false;
+                  }
+
+                  Reporter(const Reporter&) = delete;
+                  Reporter& operator=(const Reporter&) = delete;
+
+                  virtual void Begin() = 0;
+                  virtual void Report(const TestResult& result) = 0;
+                  virtual void End() = 0;
+
+            protected:
+                  Reporter() = default;
+
+                  std::ostream& Out() { return stdout_ ? *stdout_ : static_cast<std::ostream&>(file_); }
+                  bool Seekable() const { return file_.is_open(); }
+
+                  std::size_t counts_[5] = { 0, 0, 0, 0, 0 };
+                  std::size_t total_ = 0;
+
+                  void Count(const TestResult& result)
+                  {
+                        total_++;
+                        counts_[static_cast<int>(result.status)]++;
+                  }
+
+            private:
+                  /** Keeps the real stdout for the report, and points the console output at stderr */
+                  void ClaimStdout()
+                  {
+                        if (StdoutClaimed()) {
+                              std::cerr << "[!] Only one report can go to stdout" << std::endl;
+                              return;
+                        }
+                        std::cout.flush();
+#if defined(UNIPP_HAS_FORK)
+                        // On the descriptor, so that printf and child processes follow too
+                        std::fflush(stdout);
+                        saved_stdout_ = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+                        if (saved_stdout_ < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+                              std::cerr << "[!] Could not write the report to stdout: " << std::strerror(errno) << std::endl;
+                              if (saved_stdout_ >= 0) {
+                                    close(saved_stdout_);
+                              }
+                              return;
+                        }
+                        buffer_ = std::make_unique<DescriptorBuffer>(saved_stdout_);
+                        stdout_ = std::make_unique<std::ostream>(buffer_.get());
+#else
+                        console_ = std::cout.rdbuf(std::cerr.rdbuf());
+                        stdout_ = std::make_unique<std::ostream>(console_);
+#endif // UNIPP_HAS_FORK
+                        StdoutClaimed() = true;
+                  }
+
+                  std::ofstream file_;
+#if defined(UNIPP_HAS_FORK)
+                  int saved_stdout_ = -1;
+                  std::unique_ptr<DescriptorBuffer> buffer_;
+#else
+                  std::streambuf* console_ = nullptr;
+#endif // UNIPP_HAS_FORK
+                  std::unique_ptr<std::ostream> stdout_;
+            };
+
+            /**
+             * @brief JUnit XML, one testcase per test with the suite as its
+             *        classname. The totals are only known at the end: when
+             *        writing to a file, room is left for them in the
+             *        testsuite element and filled in when it is closed.
+             *        Reports covering several processes (unipp-run) are made
+             *        with an empty suite name, and start a testsuite per
+             *        process with Suite.
+             */
+            class JUnitReporter : public Reporter
+            {
+            public:
+                  explicit JUnitReporter(const std::string& path, std::string suite = "unipp")
+                        : Reporter(path), suite_(std::move(suite))
+                  {
+                  }
+
+                  void Begin() override
+                  {
+                        Out() << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n";
+                        if (!suite_.empty()) {
+                              Open();
+                        }
+                  }
+
+                  /** Closes the current testsuite, if any, and opens one with the given name */
+                  void Suite(std::string name)
+                  {
+                        if (open_) {
+                              Close();
+                        }
+                        suite_ = std::move(name);
+                        Open();
+                  }
+
+                  void Report(const TestResult& result) override
+                  {
+                        Count(result);
+                        std::ostream& out = Out();
+                        out << "    <testcase classname=\"" << XmlEscape(result.suite.empty() ? suite_ : result.suite)
+                            << "\" name=\"" << XmlEscape(result.name) << "\" time=\"" << FormatSeconds(result.duration) << "\">\n";
+                        switch (result.status) {
+                              case TestStatus::Failed:
+                              case TestStatus::TimedOut:
+                                    out << "      <failure type=\"" << (result.status == TestStatus::Failed ? "failure" : "timeout")
+                                        << "\" message=\"" << XmlEscape(result.message) << "\">" << XmlEscape(result.message) << "</failure>\n";
+                                    break;
+                              case TestStatus::Cached:
+                                    out << "      <skipped message=\"Cached, nothing it depends on changed since it last passed\"/>\n";
+                                    break;
+                              case TestStatus::Flaky:
+                                    out << "      <flakyFailure message=\"" << XmlEscape(result.message) << "\">"
+                                        << XmlEscape(result.message) << "</flakyFailure>\n";
+                                    break;
+                              case TestStatus::Passed:
+                                    break;
+                        }
+                        if (!result.output.empty()) {
+                              out << "      <system-out>" << XmlEscape(result.output) << "</system-out>\n";
+                        }
+                        out << "    </testcase>\n" << std::flush;
+                  }
+
+                  void End() override
+                  {
+                        if (open_) {
+                              Close();
+                        }
+                        Out() << "</testsuites>\n" << std::flush;
+                  }
+
+            private:
+                  void Open()
+                  {
+                        std::ostream& out = Out();
+                        out << "  <testsuite name=\"" << XmlEscape(suite_) << "\"";
+                        if (Seekable()) {
+                              totals_ = out.tellp();
+                              out << std::string(kTotalsWidth, ' ');
+                        }
+                        out << ">\n" << std::flush;
+                        open_ = true;
+                        opened_total_ = total_;
+                        std::copy(std::begin(counts_), std::end(counts_), std::begin(opened_counts_));
+                  }
+
+                  void Close()
+                  {
+                        std::ostream& out = Out();
+                        out << "  </testsuite>\n";
+                        const std::string totals = " tests=\"" + std::to_string(total_ - opened_total_)
+                              + "\" failures=\"" + std::to_string(counts_[1] + counts_[2] - opened_counts_[1] - opened_counts_[2])
+                              + "\" errors=\"0\" skipped=\"" + std::to_string(counts_[3] - opened_counts_[3]) + "\"";
+                        if (Seekable() && totals.size() <= kTotalsWidth) {
+                              const std::streampos end = out.tellp();
+                              out.seekp(totals_);
+                              out << totals;
+                              out.seekp(end);
+                        }
+                        out << std::flush;
+                        open_ = false;
+                  }
+
+                  static const std::size_t kTotalsWidth = 96;
+                  std::string suite_;
+                  bool open_ = false;
+                  std::streampos totals_;
+                  std::size_t opened_total_ = 0;
+                  std::size_t opened_counts_[5] = { 0, 0, 0, 0, 0 };
+            };
+
+            /**
+             * @brief TAP version 13. Every test point carries its duration in a
+             *        YAML block, failures also their message and output. The
+             *        plan comes last, once the number of tests is known.
+             */
+            class TapReporter : public Reporter
+            {
+            public:
+                  using Reporter::Reporter;
+
+                  void Begin() override
+                  {
+                        Out() << "TAP version 13" << std::endl;
+                  }
+
+                  void Report(const TestResult& result) override
+                  {
+                        Count(result);
+                        const bool ok = result.status == TestStatus::Passed || result.status == TestStatus::Cached
+                                        || result.status == TestStatus::Flaky;
+                        std::ostream& out = Out();
+                        out << (ok ? "ok " : "not ok ") << total_ << " - " << FullName(result.suite, result.name);
+                        if (result.status == TestStatus::Cached) {
+                              out << " # SKIP cached";
+                        }
+                        out << "\n  ---\n  duration_ms: " << std::chrono::duration_cast<std::chrono::milliseconds>(result.duration).count() << "\n";
+                        if (result.status == TestStatus::Flaky) {
+                              out << "  flaky: true\n  attempts: " << result.attempts << "\n  message: " << JsonString(result.message) << "\n";
+                        }
+                        if (!ok) {
+                              out << "  severity: " << (result.status == TestStatus::Failed ? "fail" : "timeout") << "\n"
+                                  << "  message: " << JsonString(result.message) << "\n";
+                              if (!result.output.empty()) {
+                                    out << "  output: |\n";
+                                    std::istringstream lines(result.output);
+                                    std::string line;
+                                    while (std::getline(lines, line)) {
+                                          out << "    " << line << "\n";
+                                    }
+                              }
+                        }
+                        out << "  ...\n" << std::flush;
+                  }
+
+                  void End() override
+                  {
+                        Out() << "1.." << total_ << std::endl;
+                  }
+            };
+
+#if defined(UNIPP_HAS_FORK)
+            /** A result as it crosses the channel, the strings live in the arena */
+            struct ResultRecord
+            {
+                  std::uint8_t status;
+                  std::uint32_t attempts;
+                  std::int64_t duration;
+                  std::uint64_t fingerprint;
+                  std::uint64_t offset;
+                  std::uint32_t lengths[4];
+            };
+
+            /**
+             * @brief Shared memory ring buffer that carries results from test
+             *        workers (forked or exec'd processes) to the process
+             *        running them: fixed size binary records, with their
+             *        strings in a byte ring of their own. One process writes
+             *        and one reads, so it takes no locks, and the reader does
+             *        no parsing. A worker that finds the ring full waits for
+             *        the reader, unless the reader is gone.
+             *
+             *        The reader creates the channel and passes Descriptor()
+             *        to its workers as --results=<fd>, workers attach to it
+             *        with ResultChannel(fd).
+             */
+            class ResultChannel
+            {
+            public:
+                  static constexpr std::size_t kRecords = 4096;
+                  static constexpr std::size_t kArenaSize = std::size_t(4) << 20;
+
+                  /** Creates a new channel, whose descriptor is closed on exec */
+                  ResultChannel() : owner_(true)
+                  {
+                        std::string path = (std::filesystem::temp_directory_path() / "unipp-results-XXXXXX").string();
+                        fd_ = ::mkstemp(&path[0]);
+                        if (fd_ < 0) {
+                              throw std::runtime_error("could not create a result channel in " + path);
+                        }
+                        ::unlink(path.c_str());
+                        ::fcntl(fd_, F_SETFD, FD_CLOEXEC);
+                        if (::ftruncate(fd_, static_cast<off_t>(kSize)) != 0) {
+                              ::close(fd_);
+                              throw std::runtime_error("could not size the result channel");
+                        }
+                        Map();
+                        header_->reader = ::getpid();
+                  }
+
+                  /** Attaches to the channel of a reader */
+                  explicit ResultChannel(int fd) : fd_(fd), owner_(false)
+                  {
+                        Map();
+                  }
+
+                  ResultChannel(const ResultChannel&) = delete;
+                  ResultChannel& operator=(const ResultChannel&) = delete;
+
+                  ~ResultChannel()
+                  {
+                        ::munmap(memory_, kSize);
+                        if (owner_) {
+                              ::close(fd_);
+                        }
+                  }
+
+                  int Descriptor() const { return fd_; }
+
+                  /** Writer side: false if the result was dropped, because the reader is gone */
+                  bool Publish(const TestResult& result)
+                  {
+                        // A result never takes more than a quarter of the arena, output gives way first, keeping its end
+                        const std::size_t limit = kArenaSize / 4;
+                        const std::size_t message = std::min(result.message.size(), limit / 2);
+                        const std::size_t fixed = std::min(result.suite.size() + result.name.size(), limit / 4);
+                        const std::size_t output = std::min(result.output.size(), limit - message - fixed);
+                        const std::string* strings[4] = { &result.suite, &result.name, &result.message, &result.output };
+
+                        ResultRecord record{};
+                        record.status = static_cast<std::uint8_t>(result.status);
+                        record.attempts = static_cast<std::uint32_t>(result.attempts);
+                        record.duration = static_cast<std::int64_t>(result.duration.count());
+                        record.fingerprint = result.fingerprint;
+                        record.lengths[0] = static_cast<std::uint32_t>(std::min(result.suite.size(), fixed));
+                        record.lengths[1] = static_cast<std::uint32_t>(std::min(result.name.size(), fixed - record.lengths[0]));
+                        record.lengths[2] = static_cast<std::uint32_t>(message);
+                        record.lengths[3] = static_cast<std::uint32_t>(output);
+                        const std::size_t size = record.lengths[0] + record.lengths[1] + record.lengths[2] + record.lengths[3];
+
+                        const std::uint64_t head = header_->head.load(std::memory_order_relaxed);
+                        record.offset = header_->arena_head.load(std::memory_order_relaxed);
+                        while (head - header_->tail.load(std::memory_order_acquire) >= kRecords
+                               || record.offset + size - header_->arena_tail.load(std::memory_order_acquire) > kArenaSize) {
+                              if (::kill(header_->reader, 0) != 0 && errno == ESRCH) {
+                                    return false;
+                              }
+                              std::this_thread::sleep_for(std::chrono::microseconds(50));
+                        }
+
+                        std::uint64_t at = record.offset;
+                        for (int i = 0; i < 4; i++) {
+                              const std::size_t skip = i == 3 ? strings[i]->size() - record.lengths[i] : 0;
+                              CopyIn(at, strings[i]->data() + skip, record.lengths[i]);
+                              at += record.lengths[i];
+                        }
+                        records_[head % kRecords] = record;
+                        header_->arena_head.store(at, std::memory_order_relaxed);
+                        header_->head.store(head + 1, std::memory_order_release);
+                        return true;
+                  }
+
+                  /** Reader side: hands every result published so far to each, returns how many */
+                  template<typename Each>
+                  std::size_t Drain(Each&& each)
+                  {
+                        const std::uint64_t head = header_->head.load(std::memory_order_acquire);
+                        std::uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+                        const std::size_t drained = static_cast<std::size_t>(head - tail);
+                        for (; tail != head; tail++) {
+                              const ResultRecord& record = records_[tail % kRecords];
+                              TestResult result;
+                              result.status = static_cast<TestStatus>(record.status);
+                              result.attempts = record.attempts;
+                              result.duration = std::chrono::nanoseconds(record.duration);
+                              result.fingerprint = record.fingerprint;
+                              std::string* strings[4] = { &result.suite, &result.name, &result.message, &result.output };
+                              std::uint64_t at = record.offset;
+                              for (int i = 0; i < 4; i++) {
+                                    CopyOut(at, *strings[i], record.lengths[i]);
+                                    at += record.lengths[i];
+                              }
+                              header_->arena_tail.store(at, std::memory_order_release);
+                              header_->tail.store(tail + 1, std::memory_order_release);
+                              each(std::move(result));
+                        }
+                        return drained;
+                  }
+
+            private:
+                  struct Header
+                  {
+                        std::atomic<std::uint64_t> head;
+                        std::atomic<std::uint64_t> tail;
+                        std::atomic<std::uint64_t> arena_head;
+                        std::atomic<std::uint64_t> arena_tail;
+                        pid_t reader;
+                  };
+                  static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "the result channel needs lock free 64 bit atomics");
+
+                  static constexpr std::size_t kRecordsOffset = (sizeof(Header) + 63) / 64 * 64;
+                  static constexpr std::size_t kArenaOffset = kRecordsOffset + kRecords * sizeof(ResultRecord);
+                  static constexpr std::size_t kSize = kArenaOffset + kArenaSize;
+
+                  void Map()
+                  {
+                        memory_ = ::mmap(nullptr, kSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+                        if (memory_ == MAP_FAILED) {
+                              throw std::runtime_error("could not map the result channel");
+                        }
+                        char* base = static_cast<char*>(memory_);
+                        header_ = reinterpret_cast<Header*>(base);
+                        records_ = reinterpret_cast<ResultRecord*>(base + kRecordsOffset);
+                        arena_ = base + kArenaOffset;
+                  }
+
+                  void CopyIn(std::uint64_t at, const char* data, std::size_t size)
+                  {
+                        const std::size_t start = static_cast<std::size_t>(at % kArenaSize);
+                        const std::size_t first = std::min(size, kArenaSize - start);
+                        std::memcpy(arena_ + start, data, first);
+                        std::memcpy(arena_, data + first, size - first);
+                  }
+
+                  void CopyOut(std::uint64_t at, std::string& text, std::size_t size) const
+                  {
+                        const std::size_t start = static_cast<std::size_t>(at % kArenaSize);
+                        const std::size_t first = std::min(size, kArenaSize - start);
+                        text.assign(arena_ + start, first);
+                        text.append(arena_, size - first);
+                  }
+
+                  int fd_ = -1;
+                  bool owner_;
+                  void* memory_ = nullptr;
+                  Header* header_ = nullptr;
+                  ResultRecord* records_ = nullptr;
+                  char* arena_ = nullptr;
+            };
+
+            /** Publishes results to the channel of --results, for the process that runs this one */
+            class ChannelReporter : public Reporter
+            {
+            public:
+                  explicit ChannelReporter(int fd) : channel_(fd) {}
+
+                  void Begin() override {}
+                  void Report(const TestResult& result) override { channel_.Publish(result); }
+                  void End() override {}
+
+            private:
+                  ResultChannel channel_;
+            };
+#endif // UNIPP_HAS_FORK
+
+            /** A TEST_CASE, registered before main by a static in its source file */
+            struct RegisteredTest
+            {
+                  const char* suite;
+                  const char* name;
+                  const char* description;
+                  void (*body)();
+                  const char* file;
+            };
+
+            /** The TEST_CASEs of every source file linked into the binary, in registration order */
+            inline std::vector<RegisteredTest>& Registry()
+            {
+                  static std::vector<RegisteredTest> tests;
+                  return tests;
+            }
+
+            UNIPP_API bool Register(const char* suite, const char* name, const char* description, void (*body)(), const char* file)
+            {
+                  Registry().push_back(RegisteredTest{suite, name, description, body, file});
+                  return true;
+            }
+      }
+
+
+      /**
+       * @brief TestRunner class.
+       *        Runs the tests in the test suites.
+       */
+      class TestRunner
+      {
+      public:
+            /**
+             * @brief Applies command line options, see unipp::Options.
+             *
+             *        int main(int argc, char** argv)
+             *        {
+             *              CONFIGURE(argc, argv);
+             *              return RUN(...);
+             *        }
+             */
+            static void Configure(int argc, char** argv)
+            {
+                  for (int i = 1; i < argc; i++) {
+                        const std::string argument = argv[i];
+                        const std::size_t equals = argument.find('=');
+                        const bool known = argument.compare(0, 2, "--") == 0 && detail::ParseOption(GetOptions(),
+                              argument.substr(2, equals == std::string::npos ? std::string::npos : equals - 2),
+                              equals == std::string::npos ? "" : argument.substr(equals + 1));
+                        if (!known) {
+                              std::cerr << "[!] Ignoring unknown option: " << argument << std::endl;
+                        }
+                  }
+            }
+
+            /**
+             * @brief Runs SUITES and loose TESTS, in the given order, after the
+             *        TEST_CASEs of every source file.
+             *
+             *        RUN(
+             *              SUITE("My Suite", "This is a suite description",
+             *                    TEST("My Test", "This is a test description", []() { ... }),
+             *                    TEST("My Test 2", "This is a test description", []() { ... }),
+             *                    TEST("My Test 3", "This is a test description", []() { ... })
+             *              ),
+             *              TEST("My Test", "This is a test description", []() { ... })
+             *        );
+             *
+             * @tparam Items
+             * @param items
+             * @return 0 if every test passed, 1 otherwise
+             */
+            template<typename... Items>
+            static int RunAll(Items... items)
+            {
+                  const Options& options = GetOptions();
+                  std::vector<TestSuite> plan;
+                  AddRegistered(plan);
+                  (Add(plan, items), ...);
+                  if (!options.filter.empty() || options.shard_count > 1) {
+                        std::size_t position = 0;
+                        for (auto& suite : plan) {
+                              const std::string suite_name = suite.Name();
+                              suite.Select([&suite_name, &position, &options](const UnitTest& test) {
+                                    return detail::Selected(suite_name, test.name) && position++ % options.shard_count == options.shard_index;
+                              });
+                        }
+                        plan.erase(std::remove_if(plan.begin(), plan.end(), [](const TestSuite& suite) { return suite.Tests().empty(); }), plan.end());
+                  }
+                  if (options.list) {
+                        List(plan, std::cout);
+                        return 0;
+                  }
+                  return Execute(plan);
+            }
+
+            /**
+             * @brief Writes the plan as JSON, for tools that run tests one by
+             *        one (see cmake/UnippDiscoverTests.cmake). A test's
+             *        timeout_ms is its effective limit, 0 if it has none.
+             *
+             *        { "version": "0.1.0", "suites": [ { "name": "Math", "description": "...",
+             *          "timeout_ms": 0, "tests": [ { "name": "Add", "full_name": "Math/Add",
+             *          "description": "...", "tags": [], "timeout_ms": 500 } ] } ] }
+             */
+            static void List(const std::vector<TestSuite>& plan, std::ostream& out)
+            {
+                  using detail::JsonString;
+                  out << "{\n  \"version\": " << JsonString(UNIPP_TEST_FRAMEWORK_VERSION) << ",\n  \"suites\": [";
+                  for (std::size_t i = 0; i < plan.size(); i++) {
+                        const TestSuite& suite = plan[i];
+                        out << (i ? "," : "") << "\n    {\n      \"name\": " << JsonString(suite.Name())
+                            << ",\n      \"description\": " << JsonString(suite.Description())
+                            << ",\n      \"timeout_ms\": " << suite.Budget().count() << ",\n      \"tests\": [";
+                        for (std::size_t j = 0; j < suite.Tests().size(); j++) {
+                              const UnitTest& test = suite.Tests()[j];
+                              const std::chrono::milliseconds limit = test.timeout.count() > 0 ? test.timeout : GetOptions().timeout;
+                              out << (j ? "," : "") << "\n        { \"name\": " << JsonString(test.name)
+                                  << ", \"full_name\": " << JsonString(detail::FullName(suite.Name(), test.name))
+                                  << ", \"description\": " << JsonString(test.description) << ", \"tags\": [";
+                              for (std::size_t k = 0; k < test.tags.size(); k++) {
+                                    out << (k ? ", " : "") << JsonString(test.tags[k]);
+                              }
+                              out << "], \"timeout_ms\": " << std::max<long long>(0, limit.count()) << " }";
+                        }
+                        out << (suite.Tests().empty() ? "]" : "\n      ]") << "\n    }";
+                  }
+                  out << (plan.empty() ? "]" : "\n  ]") << "\n}" << std::endl;
+            }
+
+      private:
+            TestRunner() {}
+
+            static void Add(std::vector<TestSuite>& plan, const TestSuite& suite)
+            {
+                  plan.push_back(suite);
+            }
+
+            static void Add(std::vector<TestSuite>& plan, const UnitTest& test)
+            {
+                  if (plan.empty() || !plan.back().Name().empty()) {
+                        plan.push_back(TestSuite("", ""));
+                  }
+                  plan.back().AddTests(test);
+            }
+
+            static void Add(std::vector<TestSuite>& plan, const TypedTests& typed)
+            {
+                  for (const auto& test : typed.tests) {
+                        Add(plan, test);
+                  }
+            }
+
+            /** Groups the TEST_CASEs into suites by name, each where its first test registered */
+            static void AddRegistered(std::vector<TestSuite>& plan)
+            {
+                  const std::size_t first = plan.size();
+                  for (const auto& registered : detail::Registry()) {
+                        auto suite = std::find_if(plan.begin() + first, plan.end(), [&registered](const TestSuite& candidate) {
+                              return candidate.Name() == registered.suite;
+                        });
+                        if (suite == plan.end()) {
+                              plan.push_back(TestSuite(registered.suite, ""));
+                              suite = plan.end() - 1;
+                        }
+                        suite->AddTests(UnitTest(registered.name, registered.description, registered.body).Source(registered.file));
+                  }
+            }
+
+            /**
+             * @brief Counts the results of a run as they come in, and keeps the
+             *        test history up to date.
+             */
+            struct Tally
+            {
+                  std::mutex mutex;
+                  std::size_t total = 0;
+                  std::size_t counts[5] = { 0, 0, 0, 0, 0 };
+                  bool teardown_failed = false;
+                  detail::History history;
+                  std::vector<std::unique_ptr<detail::Reporter>> reporters;
+                  std::vector<std::string> flaky;
+                  // Summary lines of the failures --quarantine let through
+                  std::vector<std::string> quarantined;
+                  std::vector<std::unique_ptr<detail::ConsoleCapture>> captures;
+
+                  void Record(TestResult result)
+                  {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        const std::string full_name = detail::FullName(result.suite, result.name);
+                        const detail::HistoryRecord* record = history.Find(full_name);
+                        // Still a failure to the history, so a test that breaks for good soon leaves the quarantine
+                        if (GetOptions().quarantine && record && record->Quarantined()
+                            && (result.status == TestStatus::Failed || result.status == TestStatus::TimedOut)) {
+                              result.quarantined = true;
+                              result.message = "Quarantined: " + result.message;
+                              quarantined.push_back(full_name + " " + ToString(result.status) + ", flaky in " + std::to_string(record->RecentFlaky())
+                                                    + " of its last " + std::to_string(record->RecentRuns()) + " runs");
+                        }
+                        else {
+                              counts[static_cast<int>(result.status)]++;
+                        }
+                        if (result.status == TestStatus::Flaky) {
+                              flaky.push_back(full_name);
+                        }
+                        total++;
+                        history.Update(result);
+                        for (auto& reporter : reporters) {
+                              reporter->Report(result);
+                        }
+                        if (result.status == TestStatus::TimedOut && detail::Stranded() > 0) {
+                              Abandon();
+                        }
+                  }
+
+                  /**
+                   * @brief Ends the process once a timed out body is left
+                   *        running: going on would run it alongside the next
+                   *        tests and its suite's teardown. The remaining tests
+                   *        are not run, the history and the reports are
+                   *        finished, and the exit code is 1.
+                   */
+                  [[noreturn]] void Abandon()
+                  {
+                        captures.clear();
+                        std::cout << "[!] A timed out test is still running, the remaining tests were not run" << std::endl;
+                        if (KeepsHistory(GetOptions())) {
+                              history.Save(GetOptions().cache);
+                        }
+                        for (auto& reporter : reporters) {
+                              reporter->End();
+                        }
+                        reporters.clear();
+                        Summarize(*this);
+                        std::cout.flush();
+                        std::cerr.flush();
+                        std::fflush(nullptr);
+                        std::_Exit(1);
+                  }
+            };
+
+            /**
+             * @brief Only runs that use the test history read and write the
+             *        cache file: parallel scheduling, --incremental, the
+             *        flakiness rates of --reruns and --quarantine. A plain
+             *        run leaves no file behind.
+             */
+            static bool KeepsHistory(const Options& options)
+            {
+                  return !options.cache.empty()
+                         && (options.jobs > 1 || options.incremental || options.reruns > 0 || options.quarantine);
+            }
+
+            static int Execute(std::vector<TestSuite>& plan)
+            {
+                  const Options& options = GetOptions();
+                  Tally tally;
+                  const bool keep_history = KeepsHistory(options);
+                  if (keep_history) {
+                        tally.history.Load(options.cache);
+                  }
+                  if (!options.junit.empty()) {
+                        tally.reporters.push_back(std::make_unique<detail::JUnitReporter>(options.junit));
+                  }
+                  if (!options.tap.empty()) {
+                        tally.reporters.push_back(std::make_unique<detail::TapReporter>(options.tap));
+                  }
+#if defined(UNIPP_HAS_FORK)
+                  if (options.results >= 0) {
+                        try {
+                              tally.reporters.push_back(std::make_unique<detail::ChannelReporter>(options.results));
+                        }
+                        catch (const std::exception& e) {
+                              std::cerr << "[!] Not publishing results, " << e.what() << std::endl;
+                        }
+                  }
+#endif // UNIPP_HAS_FORK
+                  for (auto& reporter : tally.reporters) {
+                        reporter->Begin();
+                  }
+                  // What tests print themselves goes into their output, so the reports carry it too
+                  if (!tally.reporters.empty()) {
+                        tally.captures.push_back(std::make_unique<detail::ConsoleCapture>(std::cout));
+                        tally.captures.push_back(std::make_unique<detail::ConsoleCapture>(std::cerr));
+                  }
+
+                  if (options.jobs > 1) {
+                        // Async tests are multiplexed ahead of the others, each within its suite's budget
+                        std::vector<AsyncJob> async;
+                        const auto start = std::chrono::steady_clock::now();
+                        for (const auto& suite : plan) {
+                              for (const auto& test : suite.Tests()) {
+                                    if (detail::IsAsync(test)) {
+                                          async.push_back({ &suite, &test, start + suite.Budget() });
+                                    }
+                              }
+                        }
+                        RunAsync(async, tally, options.jobs, false);
+                        RunParallel(plan, tally, options.jobs);
+                  }
+                  else {
+                        for (auto& suite : plan) {
+                              const bool torn_down = suite.Run([&tally](const TestResult& result) { tally.Record(result); },
+                                        [&suite, &tally](const UnitTest& test, std::chrono::steady_clock::time_point deadline) {
+                                              return RunPlanned(suite, test, deadline, true, tally);
+                                        },
+                                        [&suite, &tally](const std::vector<const UnitTest*>& tests, std::chrono::steady_clock::time_point deadline) {
+                                              std::vector<AsyncJob> async;
+                                              for (const UnitTest* test : tests) {
+                                                    async.push_back({ &suite, test, deadline });
+                                              }
+                                              RunAsync(async, tally, 1, true);
+                                        });
+                              tally.teardown_failed |= !torn_down;
+                        }
+                  }
+
+                  tally.captures.clear();
+                  if (keep_history) {
+                        tally.history.Save(options.cache);
+                  }
+                  for (auto& reporter : tally.reporters) {
+                        reporter->End();
+                  }
+                  return Summarize(tally);
+            }
+
+            /**
+             * @brief Runs a test of the plan, unless --incremental is on and
+             *        nothing it depends on changed since it last passed.
+             */
+            static TestResult RunPlanned(const TestSuite& suite, const UnitTest& test,
+                                         std::chrono::steady_clock::time_point deadline, bool echo, Tally& tally)
+            {
+                  TestResult result;
+                  if (!Cached(suite, test, echo, tally, result)) {
+                        const std::uint64_t fingerprint = result.fingerprint;
+                        result = Rerun(suite, test, deadline, echo, suite.RunTest(test, deadline, echo));
+                        result.fingerprint = fingerprint;
+                  }
+                  return result;
+            }
+
+            /**
+             * @brief Given the result of a test's first run, reruns it up to
+             *        --reruns times while it fails. A test that fails and then
+             *        passes is flaky, its result keeps the first failure's
+             *        message and the output of every attempt.
+             */
+            static TestResult Rerun(const TestSuite& suite, const UnitTest& test, std::chrono::steady_clock::time_point deadline, bool echo,
+                                    TestResult result)
+            {
+                  const std::size_t reruns = GetOptions().reruns;
+                  // Not while a timed out attempt is still running, the run ends instead
+                  while (result.attempts <= reruns && (result.status == TestStatus::Failed || result.status == TestStatus::TimedOut)
+                         && detail::Stranded() == 0) {
+                        const std::string note = "      [+] Rerunning, attempt " + std::to_string(result.attempts + 1) + " of " + std::to_string(reruns + 1) + "\n";
+                        if (echo) {
+                              std::cout << note << std::flush;
+                        }
+                        TestResult attempt = suite.RunTest(test, deadline, echo);
+                        result.output += note + attempt.output;
+                        result.duration += attempt.duration;
+                        result.attempts++;
+                        if (attempt.status == TestStatus::Passed) {
+                              const std::string verdict = "      [!] FLAKY: Passed on attempt " + std::to_string(result.attempts) + "\n\n";
+                              if (echo) {
+                                    std::cout << verdict << std::flush;
+                              }
+                              result.output += verdict;
+                              result.status = TestStatus::Flaky;
+                        }
+                  }
+                  return result;
+            }
+
+            /**
+             * @brief Whether --incremental lets a test be skipped, in which
+             *        case result is its Cached result. Either way the test's
+             *        fingerprint is left in result.
+             */
+            static bool Cached(const TestSuite& suite, const UnitTest& test, bool echo, Tally& tally, TestResult& result)
+            {
+                  if (!GetOptions().incremental || test.HasTag(kNondeterministic)) {
+                        return false;
+                  }
+
+                  const std::string full_name = detail::FullName(suite.Name(), test.name);
+                  result.fingerprint = detail::Fingerprint(full_name, test.source, test.inputs);
+                  bool cached = false;
+                  if (result.fingerprint != 0) {
+                        std::lock_guard<std::mutex> lock(tally.mutex);
+                        const detail::HistoryRecord* record = tally.history.Find(full_name);
+                        cached = record && !record->failed && record->fingerprint == result.fingerprint;
+                  }
+
+                  if (cached) {
+                        result.suite = suite.Name();
+                        result.name = test.name;
+                        result.status = TestStatus::Cached;
+                        result.output = "   [TEST] Cached test: " + (echo ? test.name : full_name)
+                              + "\n      [=] CACHED: Inputs unchanged since it last passed\n\n";
+                        if (echo) {
+                              std::cout << result.output << std::flush;
+                        }
+                  }
+                  return cached;
+            }
+
+            /**
+             * @brief Runs every test in the plan on a pool of workers.
+             *        Tests that failed last time go first, so regressions show
+             *        up early. The rest go longest first (LPT scheduling), so
+             *        the last tests to start are the short ones and no core is
+             *        left grinding through a long test while the others idle.
+             *        Tests without history are assumed to be long.
+             */
+            static void RunParallel(std::vector<TestSuite>& plan, Tally& tally, unsigned workers)
+            {
+                  struct Job
+                  {
+                        std::size_t suite;
+                        const UnitTest* test;
+                        bool failed;
+                        bool known;
+                        std::chrono::nanoseconds expected;
+                  };
+
+                  std::vector<Job> jobs;
+                  std::vector<std::size_t> remaining(plan.size(), 0);
+                  for (std::size_t i = 0; i < plan.size(); i++) {
+                        for (const auto& test : plan[i].Tests()) {
+                              if (detail::IsAsync(test)) {
+                                    continue;
+                              }
+                              remaining[i]++;
+                              const detail::HistoryRecord* record = tally.history.Find(detail::FullName(plan[i].Name(), test.name));
+                              jobs.push_back({ i, &test, record && record->failed, record != nullptr,
+                                               record ? record->duration : std::chrono::nanoseconds(0) });
+                        }
+                  }
+                  std::stable_sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) {
+                        if (a.failed != b.failed) {
+                              return a.failed;
+                        }
+                        if (a.known != b.known) {
+                              return !a.known;
+                        }
+                        return a.expected > b.expected;
+                  });
+
+                  // A suite's budget starts with the first of its tests to run,
+                  // and it is torn down once the last one is done
+                  std::mutex clock_mutex;
+                  std::vector<bool> started(plan.size(), false);
+                  std::vector<std::chrono::steady_clock::time_point> deadlines(plan.size());
+
+                  std::mutex console_mutex;
+                  std::atomic<std::size_t> next{0};
+                  auto worker = [&]() {
+                        for (std::size_t index = next++; index < jobs.size(); index = next++) {
+                              const Job& job = jobs[index];
+                              std::chrono::steady_clock::time_point deadline;
+                              {
+                                    std::lock_guard<std::mutex> lock(clock_mutex);
+                                    if (!started[job.suite]) {
+                                          started[job.suite] = true;
+                                          deadlines[job.suite] = std::chrono::steady_clock::now() + plan[job.suite].Budget();
+                                    }
+                                    deadline = deadlines[job.suite];
+                              }
+
+                              const TestResult result = RunPlanned(plan[job.suite], *job.test, deadline, false, tally);
+                              {
+                                    std::lock_guard<std::mutex> lock(console_mutex);
+                                    std::cout << result.output << std::flush;
+                              }
+                              tally.Record(result);
+
+                              bool last;
+                              {
+                                    std::lock_guard<std::mutex> lock(clock_mutex);
+                                    last = --remaining[job.suite] == 0;
+                              }
+                              if (last) {
+                                    std::string output;
+                                    const bool torn_down = plan[job.suite].TearDown(false, output);
+                                    std::lock_guard<std::mutex> lock(console_mutex);
+                                    std::cout << output << std::flush;
+                                    std::lock_guard<std::mutex> tally_lock(tally.mutex);
+                                    tally.teardown_failed |= !torn_down;
+                              }
+                        }
+                  };
+
+                  std::vector<std::thread> pool;
+                  for (unsigned i = 1; i < workers && i < jobs.size(); i++) {
+                        pool.emplace_back(worker);
+                  }
+                  worker();
+                  for (auto& thread : pool) {
+                        thread.join();
+                  }
+
+                  // Suites that only have async tests are still set up
+                  for (auto& suite : plan) {
+                        std::string output;
+                        tally.teardown_failed |= !suite.TearDown(false, output);
+                        std::cout << output << std::flush;
+                  }
+            }
+
+            /** An async test to run, and when its suite's budget runs out */
+            struct AsyncJob
+            {
+                  const TestSuite* suite;
+                  const UnitTest* test;
+                  std::chrono::steady_clock::time_point deadline;
+            };
+
+            /**
+             * @brief Runs async tests all at once: they are spread over one
+             *        event loop per worker, each loop on its own thread, and
+             *        take turns on it whenever they co_await. Their output is
+             *        printed whole as they finish, and the failed ones are
+             *        rerun one by one once they all did. Under --repeat and
+             *        --threads they run one by one like any other test.
+             */
+            static void RunAsync(const std::vector<AsyncJob>& jobs, Tally& tally, [[maybe_unused]] unsigned workers, bool echo)
+            {
+                  if (jobs.empty()) {
+                        return;
+                  }
+#if defined(UNIPP_HAS_COROUTINES)
+                  if (!detail::Stressing()) {
+                        Multiplex(jobs, tally, workers, echo);
+                        return;
+                  }
+#endif // UNIPP_HAS_COROUTINES
+                  for (const AsyncJob& job : jobs) {
+                        const TestResult result = RunPlanned(*job.suite, *job.test, job.deadline, echo, tally);
+                        if (!echo) {
+                              std::cout << result.output << std::flush;
+                        }
+                        tally.Record(result);
+                  }
+            }
+
+#if defined(UNIPP_HAS_COROUTINES)
+            static void Multiplex(const std::vector<AsyncJob>& jobs, Tally& tally, unsigned workers, bool echo)
+            {
+                  std::mutex console_mutex;
+                  std::vector<std::pair<const AsyncJob*, TestResult>> failed;
+                  auto report = [&](const AsyncJob& job, const TestResult& result) {
+                        std::lock_guard<std::mutex> lock(console_mutex);
+                        const bool rerun = (result.status == TestStatus::Failed || result.status == TestStatus::TimedOut)
+                                           && result.attempts <= GetOptions().reruns;
+                        if (rerun) {
+                              failed.emplace_back(&job, result);
+                              return;
+                        }
+                        std::cout << result.output << std::flush;
+                        tally.Record(result);
+                  };
+
+                  auto loop_worker = [&](std::size_t first) {
+                        std::vector<const AsyncJob*> share;
+                        for (std::size_t i = first; i < jobs.size(); i += std::max(1u, workers)) {
+                              share.push_back(&jobs[i]);
+                        }
+                        RunOnLoop(share, tally, report);
+                  };
+
+                  std::vector<std::thread> pool;
+                  for (unsigned i = 1; i < workers && i < jobs.size(); i++) {
+                        pool.emplace_back(loop_worker, i);
+                  }
+                  loop_worker(0);
+                  for (auto& thread : pool) {
+                        thread.join();
+                  }
+
+                  for (auto& [job, result] : failed) {
+                        std::cout << result.output << std::flush;
+                        const std::size_t printed = result.output.size();
+                        result = Rerun(*job->suite, *job->test, job->deadline, echo, result);
+                        if (!echo) {
+                              std::cout << result.output.substr(printed) << std::flush;
+                        }
+                        tally.Record(result);
+                  }
+            }
+
+            /**
+             * @brief Starts every given async test on a loop of this thread's
+             *        own and drives it until they are all done, failing the
+             *        ones that run out of time.
+             */
+            template<typename Report>
+            static void RunOnLoop(const std::vector<const AsyncJob*>& jobs, Tally& tally, Report report)
+            {
+                  struct Running
+                  {
+                        const AsyncJob* job;
+                        TestResult result;
+                        detail::TestContext context{false};
+                        detail::AsyncTest state;
+                        std::unique_ptr<Task> task;
+                        bool done = false;
+                        std::chrono::milliseconds limit{0};
+                        std::chrono::steady_clock::time_point started;
+                        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+                  };
+
+                  std::unique_ptr<EventLoop> loop;
+                  std::string error;
+                  try {
+                        loop = detail::MakeEventLoop();
+                  }
+                  catch (const std::exception& e) {
+                        error = e.what();
+                  }
+                  detail::CurrentLoop() = loop.get();
+
+                  std::vector<std::unique_ptr<Running>> running;
+                  for (const AsyncJob* job : jobs) {
+                        const TestSuite& suite = *job->suite;
+                        const UnitTest& test = *job->test;
+                        TestResult result;
+                        if (Cached(suite, test, false, tally, result)) {
+                              report(*job, result);
+                              continue;
+                        }
+                        std::string setup_output;
+                        const std::string setup_error = suite.SetUp(false, setup_output);
+                        if (!setup_error.empty() || !loop) {
+                              const std::uint64_t fingerprint = result.fingerprint;
+                              result = suite.Skip(test, TestStatus::Failed, loop ? "Suite setup failed: " + setup_error : error, false);
+                              result.output = setup_output + result.output;
+                              result.fingerprint = fingerprint;
+                              report(*job, result);
+                              continue;
+                        }
+
+                        auto entry = std::make_unique<Running>();
+                        Running& current = *entry;
+                        current.job = job;
+                        current.result = result;
+                        current.result.suite = suite.Name();
+                        current.result.name = test.name;
+                        current.result.output = setup_output;
+                        current.context.out << "   [TEST] Running test: " << detail::FullName(suite.Name(), test.name) << std::endl;
+                        current.context.out << "   [+] Description: " << test.description << std::endl;
+
+                        // Limited by the test's own limit and by its suite's budget, which all its async tests share
+                        const std::chrono::milliseconds limit = test.timeout.count() > 0 ? test.timeout : GetOptions().timeout;
+                        current.started = std::chrono::steady_clock::now();
+                        if (limit.count() > 0) {
+                              current.deadline = current.started + limit;
+                        }
+                        if (suite.Budget().count() > 0) {
+                              current.deadline = std::min(current.deadline, job->deadline);
+                        }
+                        if (current.deadline != std::chrono::steady_clock::time_point::max()) {
+                              current.limit = std::chrono::duration_cast<std::chrono::milliseconds>(current.deadline - current.started);
+                        }
+
+                        current.state.context = &current.context;
+                        try {
+                              current.task = detail::Start(suite.AsyncBody(test), current.state, [&current]() { current.done = true; });
+                        }
+                        catch (const std::exception& e) {
+                              detail::Fail(std::string("Uncaught exception: ") + e.what());
+                              current.done = true;
+                        }
+                        detail::Resume(nullptr);
+                        running.push_back(std::move(entry));
+                  }
+
+                  while (!running.empty()) {
+                        const auto now = std::chrono::steady_clock::now();
+                        auto next = now + std::chrono::milliseconds(100);
+                        for (std::size_t i = 0; i < running.size();) {
+                              Running& current = *running[i];
+                              const bool timed_out = !current.done && now >= current.deadline;
+                              if (!current.done && !timed_out) {
+                                    next = std::min(next, current.deadline);
+                                    i++;
+                                    continue;
+                              }
+                              Finish(current, timed_out, *loop);
+                              report(*current.job, current.result);
+                              running[i] = std::move(running.back());
+                              running.pop_back();
+                        }
+                        if (!running.empty()) {
+                              loop->RunOnce(std::chrono::duration_cast<std::chrono::milliseconds>(next - now) + std::chrono::milliseconds(1));
+                              detail::Resume(nullptr);
+                        }
+                  }
+                  detail::CurrentLoop() = nullptr;
+            }
+
+            /** Fills in the result of a finished (or timed out) async test */
+            template<typename Running>
+            static void Finish(Running& current, bool timed_out, EventLoop& loop)
+            {
+                  current.result.duration = std::chrono::steady_clock::now() - current.started;
+                  detail::Resume(&current.state);
+                  if (timed_out) {
+                        loop.Cancel(current.state.waiting);
+                        current.task.reset();
+                        current.result.status = TestStatus::TimedOut;
+                        current.result.message = "Timed out after " + detail::FormatMilliseconds(current.limit);
+                        current.context.out << "      [X] TIMED OUT: " << current.result.message << std::endl;
+                  }
+                  else {
+                        if (current.task && current.task->Handle().promise().exception) {
+                              try {
+                                    std::rethrow_exception(current.task->Handle().promise().exception);
+                              }
+                              catch (const std::exception& e) {
+                                    detail::Fail(std::string("Uncaught exception: ") + e.what());
+                              }
+                              catch (...) {
+                                    detail::Fail("Uncaught exception");
+                              }
+                        }
+                        current.task.reset();
+                        std::lock_guard<std::mutex> lock(current.context.mutex);
+                        if (current.context.failed) {
+                              current.result.status = TestStatus::Failed;
+                              current.result.message = current.context.message;
+                        }
+                  }
+                  detail::Resume(nullptr);
+                  current.result.output += current.context.capture.Text();
+            }
+#endif // UNIPP_HAS_COROUTINES
+
+            static int Summarize(const Tally& tally)
+            {
+                  std::cout << "[SUMMARY] " << tally.total << " tests: "
+                            << tally.counts[0] << " passed, " << tally.counts[1] << " failed, "
+                            << tally.counts[2] << " timed out, " << tally.counts[3] << " cached, " << tally.counts[4] << " flaky";
+                  if (!tally.quarantined.empty()) {
+                        std::cout << ", " << tally.quarantined.size() << " quarantined";
+                  }
+                  std::cout << std::endl;
+                  for (const auto& name : tally.flaky) {
+                        if (const detail::HistoryRecord* record = tally.history.Find(name)) {
+                              std::cout << "[!] Flaky: " << name << " (" << record->flaky << " of " << record->runs << " recorded runs, "
+                                        << static_cast<int>(record->FlakyRate() * 100 + 0.5) << "%)" << std::endl;
+                        }
+                  }
+                  for (const auto& line : tally.quarantined) {
+                        std::cout << "[!] Quarantined: " << line << std::endl;
+                  }
+                  if (tally.teardown_failed) {
+                        std::cout << "[!] A suite teardown failed" << std::endl;
+                  }
+                  const std::size_t passed = tally.counts[0] + tally.counts[3] + tally.counts[4] + tally.quarantined.size();
+                  return passed == tally.total && !tally.teardown_failed ? 0 : 1;
+            }
+      };
+
+
+      /**
+       * @brief Benchmark a function.
+       *        Returns the average execution time of the function.
+       *
+       * @param function
+       * @param iterations
+       * @return BenchmarkResult
+       */
+      inline BenchmarkResult Benchmark(TestFunction test, int iterations)
+      {
+            std::chrono::milliseconds total_time = std::chrono::milliseconds(0);
+
+            for (int i = 0; i < iterations; i++) {
+                  auto start = std::chrono::high_resolution_clock::now();
+                  test();
+                  auto end = std::chrono::high_resolution_clock::now();
+                  total_time += std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+            }
+
+            BenchmarkResult result(total_time, total_time / iterations);
+            return result;
+      }
+
+      /** Assertion functions, the templates are declared at the top */
+      UNIPP_API void Assert(bool condition, std::string_view message)
+      {
+            if (!condition) {
+                  detail::Raise(message);
+            }
+      }
+
+      UNIPP_API void True(bool a, std::string_view message)
+      {
+            if (!a) {
+                  detail::Raise(message);
+            }
+      }
+
+      UNIPP_API void False(bool a, std::string_view message)
+      {
+            if (a) {
+                  detail::Raise(message);
+            }
+      }
+
+
+      /** Floating point comparisons, the bulk pass behind Near and ArrayNear */
+
+      /**
+       * @brief Outcome of a bulk approximate comparison.
+       *        The maximum error only covers finite pairs, and is measured
+       *        in ULPs when the tolerance has a ULP bound, or as an absolute
+       *        difference otherwise.
+       */
+      struct ArrayComparison
+      {
+            std::size_t size = 0;
+            std::size_t mismatches = 0;
+            std::size_t first_mismatch = 0;
+            double max_error = 0.0;
+            std::size_t max_error_index = 0;
+
+            bool Passed() const { return mismatches == 0; }
+      };
+
+      namespace detail
+      {
+            template<typename T> struct FloatBits;
+            template<> struct FloatBits<float> { typedef std::uint32_t type; };
+            template<> struct FloatBits<double> { typedef std::uint64_t type; };
+
+            /**
+             * @brief Maps a float onto an unsigned line where neighbouring
+             *        representable values are neighbouring integers (and
+             *        -0.0 lands on +0.0).
+             */
+            template<typename T>
+            inline typename FloatBits<T>::type BiasedBits(T value)
+            {
+                  typedef typename FloatBits<T>::type Bits;
+                  const Bits sign = Bits(1) << (sizeof(Bits) * 8 - 1);
+                  Bits bits;
+                  std::memcpy(&bits, &value, sizeof(bits));
+                  return (bits & sign) ? Bits(~bits + 1) : Bits(bits | sign);
+            }
+
+            template<typename T>
+            inline std::uint64_t UlpDistance(T a, T b)
+            {
+                  const auto x = BiasedBits(a);
+                  const auto y = BiasedBits(b);
+                  return x > y ? x - y : y - x;
+            }
+
+            /** The exact, policy aware comparison of a single pair */
+            template<typename T>
+            inline bool NearlyEqual(T a, T b, const Tolerance& tolerance)
+            {
+                  if (std::isnan(a) || std::isnan(b)) {
+                        return tolerance.nan == NanPolicy::Equal && std::isnan(a) && std::isnan(b);
+                  }
+                  if (std::isinf(a) || std::isinf(b)) {
+                        return tolerance.inf == InfPolicy::MatchSign && a == b;
+                  }
+                  if (a == b) {
+                        return true;
+                  }
+                  const double x = a, y = b;
+                  const double diff = std::fabs(x - y);
+                  if (diff <= tolerance.absolute || diff <= tolerance.relative * std::max(std::fabs(x), std::fabs(y))) {
+                        return true;
+                  }
+                  return tolerance.ulps > 0 && UlpDistance(a, b) <= tolerance.ulps;
+            }
+
+            /** Error of a single pair, in the metric reported by ArrayComparison */
+            template<typename T>
+            inline double PairError(T a, T b, bool by_ulps)
+            {
+                  if (!std::isfinite(a) || !std::isfinite(b)) {
+                        return 0.0;
+                  }
+                  return by_ulps ? double(UlpDistance(a, b)) : std::fabs(double(a) - double(b));
+            }
+
+            /**
+             * @brief Branch free pass over a block. Returns true if every pair
+             *        is finite and within the absolute/relative bound, which
+             *        is enough for NearlyEqual to accept all of them. Anything
+             *        else is left for the exact pass.
+             */
+            template<typename T>
+            inline bool ScanBlock(const T* a, const T* b, std::size_t begin, std::size_t end,
+                                  const Tolerance& tolerance, double& block_max)
+            {
+                  const double limit = std::numeric_limits<T>::max();
+                  bool clean = true;
+                  double maximum = 0.0;
+                  for (std::size_t i = begin; i < end; i++) {
+                        const double x = a[i], y = b[i];
+                        const double diff = std::fabs(x - y);
+                        const bool finite = std::fabs(x) <= limit && std::fabs(y) <= limit;
+                        const double bound = std::max(tolerance.absolute, tolerance.relative * std::max(std::fabs(x), std::fabs(y)));
+                        clean &= finite && diff <= bound;
+                        maximum = (finite && diff > maximum) ? diff : maximum;
+                  }
+                  block_max = std::max(block_max, maximum);
+                  return clean;
+            }
+
+            /** Same as ScanBlock, against the ULP bound */
+            template<typename T>
+            inline bool ScanBlockUlps(const T* a, const T* b, std::size_t begin, std::size_t end,
+                                      const Tolerance& tolerance, double& block_max)
+            {
+                  const T limit = std::numeric_limits<T>::max();
+                  bool clean = true;
+                  std::uint64_t maximum = 0;
+                  for (std::size_t i = begin; i < end; i++) {
+                        const std::uint64_t diff = UlpDistance(a[i], b[i]);
+                        const bool finite = std::fabs(a[i]) <= limit && std::fabs(b[i]) <= limit;
+                        clean &= finite && diff <= tolerance.ulps;
+                        maximum = (finite && diff > maximum) ? diff : maximum;
+                  }
+                  block_max = std::max(block_max, double(maximum));
+                  return clean;
+            }
+
+#if defined(__SSE2__)
+            /** Two doubles at a time version of ScanBlock */
+            struct SimdScan
+            {
+                  __m128d sign, limit, absolute, relative, maximum, clean;
+
+                  SimdScan(const Tolerance& tolerance, double finite_limit)
+                        : sign(_mm_set1_pd(-0.0)), limit(_mm_set1_pd(finite_limit)),
+                          absolute(_mm_set1_pd(tolerance.absolute)), relative(_mm_set1_pd(tolerance.relative)),
+                          maximum(_mm_setzero_pd()), clean(_mm_castsi128_pd(_mm_set1_epi32(-1))) {}
+
+                  void Step(__m128d x, __m128d y)
+                  {
+                        const __m128d ax = _mm_andnot_pd(sign, x);
+                        const __m128d ay = _mm_andnot_pd(sign, y);
+                        const __m128d diff = _mm_andnot_pd(sign, _mm_sub_pd(x, y));
+                        const __m128d finite = _mm_and_pd(_mm_cmple_pd(ax, limit), _mm_cmple_pd(ay, limit));
+                        const __m128d bound = _mm_max_pd(absolute, _mm_mul_pd(relative, _mm_max_pd(ax, ay)));
+                        clean = _mm_and_pd(clean, _mm_and_pd(finite, _mm_cmple_pd(diff, bound)));
+                        maximum = _mm_max_pd(maximum, _mm_and_pd(finite, diff));
+                  }
+
+                  bool Finish(double& block_max) const
+                  {
+                        const double high = _mm_cvtsd_f64(_mm_unpackhi_pd(maximum, maximum));
+                        block_max = std::max(block_max, std::max(_mm_cvtsd_f64(maximum), high));
+                        return _mm_movemask_pd(clean) == 3;
+                  }
+            };
+
+            inline bool ScanBlock(const double* a, const double* b, std::size_t begin, std::size_t end,
+                                  const Tolerance& tolerance, double& block_max)
+            {
+                  SimdScan scan(tolerance, std::numeric_limits<double>::max());
+                  std::size_t i = begin;
+                  for (; i + 2 <= end; i += 2) {
+                        scan.Step(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+                  }
+                  const bool clean = scan.Finish(block_max);
+                  return ScanBlock<double>(a, b, i, end, tolerance, block_max) && clean;
+            }
+
+            inline bool ScanBlock(const float* a, const float* b, std::size_t begin, std::size_t end,
+                                  const Tolerance& tolerance, double& block_max)
+            {
+                  SimdScan scan(tolerance, std::numeric_limits<float>::max());
+                  std::size_t i = begin;
+                  for (; i + 4 <= end; i += 4) {
+                        const __m128 x = _mm_loadu_ps(a + i);
+                        const __m128 y = _mm_loadu_ps(b + i);
+                        scan.Step(_mm_cvtps_pd(x), _mm_cvtps_pd(y));
+                        scan.Step(_mm_cvtps_pd(_mm_movehl_ps(x, x)), _mm_cvtps_pd(_mm_movehl_ps(y, y)));
+                  }
+                  const bool clean = scan.Finish(block_max);
+                  return ScanBlock<float>(a, b, i, end, tolerance, block_max) && clean;
+            }
+#endif // __SSE2__
+
+            inline constexpr std::size_t kCompareBlock = 4096;
+
+            template<typename T>
+            inline std::string DescribeValue(T value)
+            {
+                  std::ostringstream stream;
+                  stream.precision(std::numeric_limits<T>::max_digits10);
+                  stream << value;
+                  return stream.str();
+            }
+      }
+
+      /**
+       * @brief Compares two arrays element-wise under a tolerance.
+       *        Blocks are first cleared by a vectorised pass, only blocks
+       *        with a suspicious pair are walked again with the exact
+       *        policy aware comparison.
+       *
+       * @return ArrayComparison
+       */
+      template<typename T>
+      inline ArrayComparison CompareArrays(const T* a, const T* b, std::size_t size, const Tolerance& tolerance)
+      {
+            static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value,
+                          "CompareArrays only supports float and double");
+
+            ArrayComparison result;
+            result.size = size;
+            const bool by_ulps = tolerance.ulps > 0;
+
+            for (std::size_t begin = 0; begin < size; begin += detail::kCompareBlock) {
+                  const std::size_t end = std::min(size, begin + detail::kCompareBlock);
+                  double block_max = 0.0;
+                  const bool clean = by_ulps
+                        ? detail::ScanBlockUlps(a, b, begin, end, tolerance, block_max)
+                        : detail::ScanBlock(a, b, begin, end, tolerance, block_max);
+
+                  if (!clean) {
+                        for (std::size_t i = begin; i < end; i++) {
+                              if (!detail::NearlyEqual(a[i], b[i], tolerance) && result.mismatches++ == 0) {
+                                    result.first_mismatch = i;
+                              }
+                        }
+                  }
+
+                  if (block_max > result.max_error) {
+                        for (std::size_t i = begin; i < end; i++) {
+                              if (detail::PairError(a[i], b[i], by_ulps) == block_max) {
+                                    result.max_error = block_max;
+                                    result.max_error_index = i;
+                                    break;
+                              }
+                        }
+                  }
+            }
+
+            return result;
+      }
+
+      namespace detail
+      {
+            template<typename T>
+            inline void NearImpl(T x, T y, const Tolerance& tolerance, std::string_view message)
+            {
+                  if (!NearlyEqual(x, y, tolerance)) {
+                        Raise(std::string(message) + " (" + DescribeValue(x) + " vs " + DescribeValue(y)
+                              + ", error " + DescribeValue(std::fabs(double(x) - double(y)))
+                              + ", " + std::to_string(UlpDistance(x, y)) + " ulps)");
+                  }
+            }
+
+            template<typename T>
+            inline void ArrayNearImpl(const T* a, const T* b, std::size_t size, const Tolerance& tolerance,
+                                      std::string_view message)
+            {
+                  const ArrayComparison result = CompareArrays(a, b, size, tolerance);
+                  if (!result.Passed()) {
+                        const std::size_t first = result.first_mismatch;
+                        const std::size_t worst = result.max_error_index;
+                        Raise(std::string(message) + " (" + std::to_string(result.mismatches) + " of "
+                              + std::to_string(size) + " elements differ, first at index " + std::to_string(first) + ": "
+                              + DescribeValue(a[first]) + " vs " + DescribeValue(b[first])
+                              + "; max error " + DescribeValue(result.max_error) + (tolerance.ulps > 0 ? " ulps" : "")
+                              + " at index " + std::to_string(worst) + ": "
+                              + DescribeValue(a[worst]) + " vs " + DescribeValue(b[worst]) + ")");
+                  }
+            }
+
+            UNIPP_API void CheckNear(float a, float b, const Tolerance& tolerance, std::string_view message)
+            {
+                  NearImpl(a, b, tolerance, message);
+            }
+
+            UNIPP_API void CheckNear(double a, double b, const Tolerance& tolerance, std::string_view message)
+            {
+                  NearImpl(a, b, tolerance, message);
+            }
+
+            UNIPP_API void CheckArrayNear(const float* a, const float* b, std::size_t size,
+                                          const Tolerance& tolerance, std::string_view message)
+            {
+                  ArrayNearImpl(a, b, size, tolerance, message);
+            }
+
+            UNIPP_API void CheckArrayNear(const double* a, const double* b, std::size_t size,
+                                          const Tolerance& tolerance, std::string_view message)
+            {
+                  ArrayNearImpl(a, b, size, tolerance, message);
+            }
+
+            UNIPP_API void CheckSizes(std::size_t a, std::size_t b, std::string_view message)
+            {
+                  if (a != b) {
+                        Raise(std::string(message) + " (size mismatch: " + std::to_string(a)
+                              + " vs " + std::to_string(b) + ")");
+                  }
+            }
+      }
+
+
+      /** Constexpr tests */
+
+      /**
+       * @brief Check usable in constant expressions. When a failing check is
+       *        evaluated at compile time the throw makes the expression non
+       *        constant, so the compiler reports it (and the message) as an
+       *        error. At run time it fails like ASSERT.
+       */
+      constexpr void ConstexprAssert(bool condition, const char* message)
+      {
+            if (!condition) {
+                  throw std::runtime_error(message);
+            }
+      }
+
+      namespace detail
+      {
+            /** Runs a constexpr test body, returning bool or void */
+            template<typename Function>
+            constexpr bool ConstexprPasses(Function function)
+            {
+                  if constexpr (std::is_void_v<std::invoke_result_t<Function&>>) {
+                        function();
+                        return true;
+                  }
+                  else {
+                        return static_cast<bool>(function());
+                  }
+            }
+      }
+
+      /**
+       * @brief Test whose body is also evaluated at compile time, through
+       *        CONSTEXPR_TEST: a failure breaks the build before any test
+       *        binary runs. The same body runs again as a regular test.
+       *
+       *        CONSTEXPR_TEST("Parse", "Parses at compile time", []() {
+       *              CONSTEXPR_ASSERT_EQUAL(ParseInt("42"), 42, "Parses digits");
+       *              return ParseInt("-7") == -7;
+       *        })
+       */
+      template<typename Function>
+      inline UnitTest ConstexprTest(std::string name, std::string description, Function function)
+      {
+            return UnitTest(name, description, [function]() {
+                  BASE_ASSERT(unipp::Assert(detail::ConstexprPasses(function), "Constexpr test returned false");)
+            });
+      }
+
+
+      /** Death tests */
+
+      /**
+       * @brief How a death test expects its child to end, given the status
+       *        waitpid reported for it.
+       */
+      struct ExitPredicate
+      {
+            std::function<bool(int)> matches;
+            std::string description;
+      };
+
+      /** Exited with a non-zero code or was killed by a signal */
+      inline ExitPredicate Died()
+      {
+#if defined(UNIPP_HAS_FORK)
+            return { [](int status) { return WIFSIGNALED(status) || (WIFEXITED(status) && WEXITSTATUS(status) != 0); },
+                     "exit with a non-zero code or be killed by a signal" };
+#else
+            return { [](int) { return false; }, "die" };
+#endif // UNIPP_HAS_FORK
+      }
+
+      /** Exited normally with the given code */
+      inline ExitPredicate ExitedWith(int code)
+      {
+#if defined(UNIPP_HAS_FORK)
+            return { [code](int status) { return WIFEXITED(status) && WEXITSTATUS(status) == code; },
+                     "exit with code " + std::to_string(code) };
+#else
+            return { [](int) { return false; }, "exit with code " + std::to_string(code) };
+#endif // UNIPP_HAS_FORK
+      }
+
+      /** Was killed by the given signal, e.g. SIGABRT */
+      inline ExitPredicate KilledBySignal(int signal)
+      {
+#if defined(UNIPP_HAS_FORK)
+            return { [signal](int status) { return WIFSIGNALED(status) && WTERMSIG(status) == signal; },
+                     "be killed by signal " + std::to_string(signal) };
+#else
+            return { [](int) { return false; }, "be killed by signal " + std::to_string(signal) };
+#endif // UNIPP_HAS_FORK
+      }
+
+#if defined(UNIPP_HAS_FORK)
+      namespace detail
+      {
+            inline std::string DescribeStatus(int status)
+            {
+                  if (WIFEXITED(status)) {
+                        return "exited with code " + std::to_string(WEXITSTATUS(status));
+                  }
+                  if (WIFSIGNALED(status)) {
+                        const char* name = ::strsignal(WTERMSIG(status));
+                        return "was killed by signal " + std::to_string(WTERMSIG(status)) + (name ? std::string(" (") + name + ")" : "");
+                  }
+                  return "ended with status " + std::to_string(status);
+            }
+
+            /** The last lines of a child's stderr, indented under the failure */
+            inline std::string ClipStderr(const std::string& text)
+            {
+                  const std::size_t kMaxLength = 1024;
+                  std::string clipped = text.size() > kMaxLength ? "..." + text.substr(text.size() - kMaxLength) : text;
+                  while (!clipped.empty() && clipped.back() == '\n') {
+                        clipped.pop_back();
+                  }
+                  std::string indented;
+                  for (char c : clipped) {
+                        indented += c;
+                        if (c == '\n') {
+                              indented += "         ";
+                        }
+                  }
+                  return indented.empty() ? "(empty)" : indented;
+            }
+
+            /**
+             * @brief Runs statement in a forked child (no exec, so it is about
+             *        as cheap as a process can be) with its stderr going to
+             *        a pipe, and waits for it.
+             *
+             * @param status Set to the child's waitpid status
+             * @return What the child wrote to stderr
+             */
+            inline std::string RunInChild(const TestFunction& statement, int& status)
+            {
+                  int pipe_fds[2];
+                  if (::pipe(pipe_fds) != 0) {
+                        throw std::runtime_error("could not create a pipe for the death test");
+                  }
+                  std::cout.flush();
+                  std::cerr.flush();
+                  std::fflush(nullptr);
+
+                  const pid_t pid = ::fork();
+                  if (pid < 0) {
+                        ::close(pipe_fds[0]);
+                        ::close(pipe_fds[1]);
+                        throw std::runtime_error("could not fork the death test");
+                  }
+
+                  if (pid == 0) {
+                        // Only this thread made it into the child, and the output of the test is not ours to write to
+                        ::dup2(pipe_fds[1], STDERR_FILENO);
+                        ::close(pipe_fds[0]);
+                        ::close(pipe_fds[1]);
+                        const int null = ::open("/dev/null", O_WRONLY);
+                        if (null >= 0) {
+                              ::dup2(null, STDOUT_FILENO);
+                              ::close(null);
+                        }
+                        CurrentContext() = nullptr;
+                        try {
+                              statement();
+                        }
+                        catch (const std::exception& e) {
+                              std::fprintf(stderr, "Uncaught exception: %s\n", e.what());
+                              std::abort();
+                        }
+                        catch (...) {
+                              std::fprintf(stderr, "Uncaught exception\n");
+                              std::abort();
+                        }
+                        std::fflush(nullptr);
+                        std::_Exit(0);
+                  }
+
+                  ::close(pipe_fds[1]);
+                  std::string text;
+                  const TestContext* context = CurrentContext();
+                  const auto deadline = context ? context->deadline : std::chrono::steady_clock::time_point::max();
+                  const auto start = std::chrono::steady_clock::now();
+                  bool killed = false;
+                  char buffer[4096];
+                  for (;;) {
+                        pollfd fd{ pipe_fds[0], POLLIN, 0 };
+                        int wait = -1;
+                        if (deadline != std::chrono::steady_clock::time_point::max()) {
+                              const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                              wait = static_cast<int>(std::max<long long>(0, left.count()));
+                        }
+                        const int ready = ::poll(&fd, 1, wait);
+                        if (ready < 0 && errno == EINTR) {
+                              continue;
+                        }
+                        if (ready == 0) {
+                              ::kill(pid, SIGKILL);
+                              killed = true;
+                              break;
+                        }
+                        const ssize_t size = ::read(pipe_fds[0], buffer, sizeof(buffer));
+                        if (size < 0 && errno == EINTR) {
+                              continue;
+                        }
+                        if (size <= 0) {
+                              break;
+                        }
+                        text.append(buffer, static_cast<std::size_t>(size));
+                  }
+                  ::close(pipe_fds[0]);
+
+                  while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+                  }
+                  if (killed) {
+                        throw std::runtime_error("the statement was still running after " + FormatMilliseconds(std::chrono::steady_clock::now() - start)
+                              + ", when the test ran out of time");
+                  }
+                  return text;
+            }
+      }
+#endif // UNIPP_HAS_FORK
+
+      /**
+       * @brief Runs statement in a forked child and checks that it ends the
+       *        way predicate expects, having written something matching
+       *        pattern (an ECMAScript regex, searched for) to stderr.
+       *        An exception escaping the statement aborts the child, as it
+       *        would the real program.
+       *
+       *        ASSERT_DEATH(queue.Pop(), "Pop on an empty queue", "Expected Pop to abort");
+       *        ASSERT_EXIT(Shutdown(), unipp::ExitedWith(3), "", "Expected exit code 3");
+       *
+       *        The child only has the thread that forked it, so the statement
+       *        must not need locks other threads may have held at the time.
+       */
+      inline void Dies(const TestFunction& statement, const ExitPredicate& predicate, const std::string& pattern, std::string message = "")
+      {
+#if defined(UNIPP_HAS_FORK)
+            int status = 0;
+            std::string text;
+            try {
+                  text = detail::RunInChild(statement, status);
+            }
+            catch (const std::exception& e) {
+                  throw std::runtime_error(message + " (death test: " + e.what() + ")");
+            }
+
+            if (!predicate.matches(status)) {
+                  throw std::runtime_error(message + " (expected the statement to " + predicate.description + ", but it "
+                        + detail::DescribeStatus(status) + "; stderr:\n         " + detail::ClipStderr(text) + ")");
+            }
+            if (!pattern.empty() && !std::regex_search(text, std::regex(pattern))) {
+                  throw std::runtime_error(message + " (expected stderr to match \"" + pattern + "\", but it was:\n         "
+                        + detail::ClipStderr(text) + ")");
+            }
+#else
+            (void)statement;
+            (void)predicate;
+            (void)pattern;
+            throw std::runtime_error(message + " (death tests need fork, which this platform lacks)");
+#endif // UNIPP_HAS_FORK
+      }
+
+
+      /** Snapshot (golden file) comparisons */
+
+      namespace detail
+      {
+            /** Offset of the first differing byte, in chunks so memcmp does the heavy lifting */
+            inline std::size_t FirstDifference(const char* a, const char* b, std::size_t size)
+            {
+                  const std::size_t chunk = 4096;
+                  std::size_t offset = 0;
+                  while (offset + chunk <= size && std::memcmp(a + offset, b + offset, chunk) == 0) {
+                        offset += chunk;
+                  }
+                  while (offset < size && a[offset] == b[offset]) {
+                        offset++;
+                  }
+                  return offset;
+            }
+
+            inline bool LooksLikeText(const char* data, std::size_t size)
+            {
+                  for (std::size_t i = 0; i < size; i++) {
+                        const unsigned char c = static_cast<unsigned char>(data[i]);
+                        if (c < 0x20 && c != '\n' && c != '\r' && c != '\t') {
+                              return false;
+                        }
+                  }
+                  return true;
+            }
+
+            /** Up to 80 characters of the line holding offset, centred on it */
+            inline std::string LineExcerpt(const char* data, std::size_t size, std::size_t offset)
+            {
+                  if (offset > size) {
+                        offset = size;
+                  }
+                  std::size_t begin = offset, end = offset;
+                  while (begin > 0 && data[begin - 1] != '\n' && offset - begin < 40) {
+                        begin--;
+                  }
+                  while (end < size && data[end] != '\n' && end - begin < 80) {
+                        end++;
+                  }
+                  return (begin > 0 && data[begin - 1] != '\n' ? "..." : "") + std::string(data + begin, end - begin)
+                         + (end < size && data[end] != '\n' ? "..." : "");
+            }
+
+            inline std::string HexExcerpt(const char* data, std::size_t size, std::size_t offset)
+            {
+                  static const char digits[] = "0123456789abcdef";
+                  const std::size_t begin = offset & ~std::size_t(15);
+                  std::string text;
+                  for (std::size_t i = begin; i < begin + 16 && i < size; i++) {
+                        const unsigned char c = static_cast<unsigned char>(data[i]);
+                        text += i == offset ? '[' : ' ';
+                        text += digits[c >> 4];
+                        text += digits[c & 0xF];
+                        text += i == offset ? ']' : ' ';
+                  }
+                  return text;
+            }
+
+            /** Where and how a snapshot differs from the produced data */
+            inline std::string DescribeSnapshotMismatch(const char* expected, std::size_t expected_size,
+                                                        const char* actual, std::size_t actual_size)
+            {
+                  const std::size_t offset = FirstDifference(expected, actual, std::min(expected_size, actual_size));
+                  std::ostringstream diff;
+                  diff << "first difference at byte " << offset;
+
+                  const std::size_t window_begin = offset > 64 ? offset - 64 : 0;
+                  const bool text = LooksLikeText(expected + window_begin, std::min(expected_size, offset + 64) - window_begin)
+                                    && LooksLikeText(actual + window_begin, std::min(actual_size, offset + 64) - window_begin);
+                  if (text) {
+                        std::size_t line = 1, column = 1;
+                        for (const char* c = expected; (c = static_cast<const char*>(std::memchr(c, '\n', expected + offset - c))); c++) {
+                              line++;
+                        }
+                        for (std::size_t i = offset; i > 0 && expected[i - 1] != '\n'; i--) {
+                              column++;
+                        }
+                        diff << " (line " << line << ", column " << column << ")";
+                  }
+                  diff << ", expected " << expected_size << " bytes, got " << actual_size;
+
+                  if (text) {
+                        diff << "\n         expected: " << LineExcerpt(expected, expected_size, offset)
+                             << "\n         actual:   " << LineExcerpt(actual, actual_size, offset);
+                  }
+                  else {
+                        diff << "\n         expected: " << HexExcerpt(expected, expected_size, offset)
+                             << "\n         actual:   " << HexExcerpt(actual, actual_size, offset);
+                  }
+                  return diff.str();
+            }
+
+            inline bool WriteFileAtomically(const std::string& path, const char* data, std::size_t size)
+            {
+                  std::error_code ignored;
+                  const std::filesystem::path parent = std::filesystem::path(path).parent_path();
+                  if (!parent.empty()) {
+                        std::filesystem::create_directories(parent, ignored);
+                  }
+                  const std::string temporary = path + ".tmp";
+                  {
+                        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+                        file.write(data, static_cast<std::streamsize>(size));
+                        if (!file) {
+                              return false;
+                        }
+                  }
+                  return std::rename(temporary.c_str(), path.c_str()) == 0;
+            }
+      }
+
+      /**
+       * @brief Compares data against a golden file.
+       *        The golden file is memory-mapped and compared in place, so
+       *        large snapshots are never copied. With --update-snapshots
+       *        the golden file is (re)written instead.
+       */
+      inline void Snapshot(const void* data, std::size_t size, const std::string& path, std::string message = "")
+      {
+            const char* actual = static_cast<const char*>(data);
+            if (GetOptions().update_snapshots) {
+                  detail::MappedFile current(path);
+                  if (current.Valid() && current.Size() == size && std::memcmp(current.Data(), actual, size) == 0) {
+                        return;
+                  }
+                  if (!detail::WriteFileAtomically(path, actual, size)) {
+                        throw std::runtime_error(message + " (could not write snapshot " + path + ")");
+                  }
+                  detail::Out() << "      [~] UPDATED: " << path << std::endl;
+                  return;
+            }
+
+            detail::MappedFile golden(path);
+            if (!golden.Valid()) {
+                  throw std::runtime_error(message + " (snapshot " + path + " not found, run with --update-snapshots to create it)");
+            }
+            if (golden.Size() != size || std::memcmp(golden.Data(), actual, size) != 0) {
+                  throw std::runtime_error(message + " (snapshot " + path + ": "
+                        + detail::DescribeSnapshotMismatch(golden.Data(), golden.Size(), actual, size) + ")");
+            }
+      }
+
+      inline void Snapshot(std::string_view actual, const std::string& path, std::string message = "")
+      {
+            Snapshot(actual.data(), actual.size(), path, message);
+      }
+
+
+      /** Allocation free scopes */
+
+      namespace detail
+      {
+            inline constexpr int kMaxAllocationFrames = 12;
+
+            /**
+             * @brief Heap activity of one thread, counted by the operator new
+             *        and delete replacements of UNIPP_ALLOC_HOOKS while an
+             *        allocation free scope is open on it. Trivial so that it
+             *        needs no dynamic initialisation, which could allocate.
+             */
+            struct AllocationTracker
+            {
+                  unsigned depth;
+                  bool busy;
+                  std::size_t allocations;
+                  std::size_t frees;
+                  std::size_t bytes;
+                  bool recorded;
+                  bool first_is_free;
+                  std::size_t first_size;
+                  void* frames[kMaxAllocationFrames];
+                  int frame_count;
+            };
+
+            inline thread_local AllocationTracker allocation_tracker;
+
+            /** Set when the binary was built with UNIPP_ALLOC_HOOKS */
+            inline std::atomic<bool> allocation_hooks{false};
+
+            /** Called by the hooks on every allocation and free */
+            inline void NoteAllocation(std::size_t size, bool is_free)
+            {
+                  AllocationTracker& tracker = allocation_tracker;
+                  if (tracker.depth == 0 || tracker.busy) {
+                        return;
+                  }
+                  tracker.busy = true;
+                  if (is_free) {
+                        tracker.frees++;
+                  }
+                  else {
+                        tracker.allocations++;
+                        tracker.bytes += size;
+                  }
+                  if (!tracker.recorded) {
+                        tracker.recorded = true;
+                        tracker.first_is_free = is_free;
+                        tracker.first_size = size;
+#if defined(UNIPP_HAS_STACKTRACE)
+                        tracker.frame_count = backtrace(tracker.frames, kMaxAllocationFrames);
+#endif // UNIPP_HAS_STACKTRACE
+                  }
+                  tracker.busy = false;
+            }
+
+            /**
+             * @brief Scope of UNIPP_ASSERT_NO_ALLOC / UNIPP_EXPECT_NO_ALLOC.
+             *        On exit, fails the test (or warns) if the current
+             *        thread allocated or freed heap memory inside it,
+             *        reporting where the first allocation happened.
+             */
+            class NoAllocScope
+            {
+            public:
+                  NoAllocScope(const char* file, int line, bool fatal) : file_(file), line_(line), fatal_(fatal)
+                  {
+                        if (!allocation_hooks.load(std::memory_order_relaxed)) {
+                              static std::once_flag warning;
+                              std::call_once(warning, []() {
+                                    Out() << "      [!] WARNING: Allocations are not tracked, define UNIPP_ALLOC_HOOKS in one source file of the test binary" << std::endl;
+                              });
+                        }
+#if defined(UNIPP_HAS_STACKTRACE)
+                        // The first backtrace() call may allocate, get it out of the way
+                        void* warmup[1];
+                        backtrace(warmup, 1);
+#endif // UNIPP_HAS_STACKTRACE
+                        AllocationTracker& tracker = allocation_tracker;
+                        allocations_ = tracker.allocations;
+                        frees_ = tracker.frees;
+                        bytes_ = tracker.bytes;
+                        if (tracker.depth++ == 0) {
+                              tracker.recorded = false;
+                        }
+                  }
+
+                  NoAllocScope(const NoAllocScope&) = delete;
+                  NoAllocScope& operator=(const NoAllocScope&) = delete;
+
+                  ~NoAllocScope()
+                  {
+                        AllocationTracker& tracker = allocation_tracker;
+                        tracker.depth--;
+                        const std::size_t allocations = tracker.allocations - allocations_;
+                        const std::size_t frees = tracker.frees - frees_;
+                        if (allocations == 0 && frees == 0) {
+                              if (fatal_) {
+                                    Pass();
+                              }
+                              return;
+                        }
+
+                        const std::string message = std::to_string(allocations) + " allocations (" + std::to_string(tracker.bytes - bytes_)
+                              + " bytes) and " + std::to_string(frees) + " frees in the allocation free scope at " + file_ + ":" + std::to_string(line_);
+                        if (fatal_) {
+                              Fail(message);
+                        }
+                        else {
+                              Out() << "      [!] WARNING: " << message << std::endl;
+                        }
+                        if (tracker.recorded) {
+                              Out() << "      [+] First " << (tracker.first_is_free ? "free" : "allocation of " + std::to_string(tracker.first_size) + " bytes")
+                                    << ":" << std::endl << Site(tracker);
+                              tracker.recorded = tracker.depth > 0;
+                        }
+                  }
+
+            private:
+                  static std::string Site(const AllocationTracker& tracker)
+                  {
+#if defined(UNIPP_HAS_STACKTRACE)
+                        std::ostringstream site;
+                        // Skip NoteAllocation and the operator new or delete that called it
+                        char** symbols = backtrace_symbols(tracker.frames, tracker.frame_count);
+                        for (int i = 2; symbols && i < tracker.frame_count; i++) {
+                              site << "            #" << (i - 2) << " " << DemangleFrame(symbols[i]) << std::endl;
+                        }
+                        std::free(symbols);
+                        return site.str();
+#else
+                        (void)tracker;
+                        return "         <stack traces are not supported on this platform>\n";
+#endif // UNIPP_HAS_STACKTRACE
+                  }
+
+                  const char* file_;
+                  int line_;
+                  bool fatal_;
+                  std::size_t allocations_;
+                  std::size_t frees_;
+                  std::size_t bytes_;
+            };
+      }
+
+
+      /** Property based testing */
+
+      /**
+       * @brief Generators for property tests.
+       *        A generator has a value_type, produces values from a Random
+       *        and a size hint that grows over the run (so early cases are
+       *        small), and proposes simpler candidates for a failing value.
+       *
+       *        struct MyGenerator
+       *        {
+       *              typedef T value_type;
+       *              T Generate(unipp::Random& random, std::size_t size) const;
+       *              std::vector<T> Shrink(const T& value) const;
+       *        };
+       */
+      namespace gen
+      {
+            template<typename T>
+            struct Integral
+            {
+                  typedef T value_type;
+                  T low, high;
+
+                  Integral(T low, T high) : low(low), high(high) {}
+
+                  T Generate(Random& random, std::size_t) const
+                  {
+                        // Boundaries are where the bugs live, hit them now and then
+                        switch (random.Below(16)) {
+                              case 0: return low;
+                              case 1: return high;
+                              case 2: return Target();
+                              default: return random.Between(low, high);
+                        }
+                  }
+
+                  /** The target itself, then values halving the distance to it */
+                  std::vector<T> Shrink(const T& value) const
+                  {
+                        std::vector<T> candidates;
+                        const T target = Target();
+                        if (value == target) {
+                              return candidates;
+                        }
+                        candidates.push_back(target);
+                        for (T step = static_cast<T>((value - target) / 2); step != 0; step = static_cast<T>(step / 2)) {
+                              candidates.push_back(static_cast<T>(value - step));
+                        }
+                        return candidates;
+                  }
+
+                  /** Zero when in range, the bound closest to it otherwise */
+                  T Target() const
+                  {
+                        return low > 0 ? low : (high < 0 ? high : T(0));
+                  }
+            };
+
+            template<typename T>
+            struct Floating
+            {
+                  typedef T value_type;
+                  T low, high;
+
+                  Floating(T low, T high) : low(low), high(high) {}
+
+                  T Generate(Random& random, std::size_t) const
+                  {
+                        switch (random.Below(16)) {
+                              case 0: return low;
+                              case 1: return high;
+                              case 2: return Target();
+                              default: return static_cast<T>(low + (high - low) * random.Uniform());
+                        }
+                  }
+
+                  std::vector<T> Shrink(const T& value) const
+                  {
+                        std::vector<T> candidates;
+                        const T target = Target();
+                        if (value == target || std::isnan(value)) {
+                              return candidates;
+                        }
+                        candidates.push_back(target);
+                        const T whole = std::trunc(value);
+                        if (whole != value && whole >= low && whole <= high) {
+                              candidates.push_back(whole);
+                        }
+                        const T half = target + (value - target) / 2;
+                        if (half != value && half != target) {
+                              candidates.push_back(half);
+                        }
+                        return candidates;
+                  }
+
+                  T Target() const
+                  {
+                        return low > 0 ? low : (high < 0 ? high : T(0));
+                  }
+            };
+
+            struct Boolean
+            {
+                  typedef bool value_type;
+
+                  bool Generate(Random& random, std::size_t) const { return random.Below(2) == 1; }
+                  std::vector<bool> Shrink(const bool& value) const { return value ? std::vector<bool>{ false } : std::vector<bool>(); }
+            };
+
+            /** One of a fixed set of values, shrinking towards the first ones */
+            template<typename T>
+            struct Element
+            {
+                  typedef T value_type;
+                  std::vector<T> values;
+
+                  explicit Element(std::vector<T> values) : values(values) {}
+
+                  T Generate(Random& random, std::size_t) const { return values[random.Below(values.size())]; }
+
+                  std::vector<T> Shrink(const T& value) const
+                  {
+                        const auto position = std::find(values.begin(), values.end(), value);
+                        return std::vector<T>(values.begin(), position);
+                  }
+            };
+
+            /**
+             * @brief Sequences (std::vector, std::string) of generated elements.
+             *        Shrinks by dropping halves, then single elements, then by
+             *        shrinking the elements themselves.
+             */
+            template<typename Container, typename Generator>
+            struct Sequence
+            {
+                  typedef Container value_type;
+                  Generator element;
+                  std::size_t max_size;
+
+                  Sequence(Generator element, std::size_t max_size) : element(element), max_size(max_size) {}
+
+                  Container Generate(Random& random, std::size_t size) const
+                  {
+                        Container values;
+                        const std::size_t length = random.Below(std::min(max_size, size) + 1);
+                        for (std::size_t i = 0; i < length; i++) {
+                              values.push_back(element.Generate(random, size));
+                        }
+                        return values;
+                  }
+
+                  std::vector<Container> Shrink(const Container& value) const
+                  {
+                        std::vector<Container> candidates;
+                        if (value.empty()) {
+                              return candidates;
+                        }
+                        candidates.push_back(Container());
+                        const std::size_t half = value.size() / 2;
+                        if (half > 0) {
+                              candidates.push_back(Container(value.begin(), value.begin() + half));
+                              candidates.push_back(Container(value.begin() + half, value.end()));
+                        }
+                        for (std::size_t i = 0; i < value.size() && value.size() > 1; i++) {
+                              Container smaller = value;
+                              smaller.erase(smaller.begin() + i);
+                              candidates.push_back(smaller);
+                        }
+                        for (std::size_t i = 0; i < value.size(); i++) {
+                              for (const auto& simpler : element.Shrink(value[i])) {
+                                    Container changed = value;
+                                    changed[i] = simpler;
+                                    candidates.push_back(changed);
+                              }
+                        }
+                        return candidates;
+                  }
+            };
+
+            inline Integral<int> Int(int low = std::numeric_limits<int>::min(), int high = std::numeric_limits<int>::max())
+            {
+                  return Integral<int>(low, high);
+            }
+
+            template<typename T>
+            inline Integral<T> Integer(T low = std::numeric_limits<T>::min(), T high = std::numeric_limits<T>::max())
+            {
+                  return Integral<T>(low, high);
+            }
+
+            inline Floating<double> Double(double low = -1e9, double high = 1e9)
+            {
+                  return Floating<double>(low, high);
+            }
+
+            inline Boolean Bool()
+            {
+                  return Boolean();
+            }
+
+            template<typename T>
+            inline Element<T> OneOf(std::vector<T> values)
+            {
+                  return Element<T>(values);
+            }
+
+            template<typename Generator>
+            inline Sequence<std::vector<typename Generator::value_type>, Generator> VectorOf(Generator element, std::size_t max_size = 100)
+            {
+                  return Sequence<std::vector<typename Generator::value_type>, Generator>(element, max_size);
+            }
+
+            /** Printable ASCII strings */
+            inline Sequence<std::string, Integral<char>> String(std::size_t max_size = 100)
+            {
+                  return Sequence<std::string, Integral<char>>(Integral<char>(' ', '~'), max_size);
+            }
+      }
+
+      namespace detail
+      {
+            template<typename T, typename = void>
+            struct IsPrintable : std::false_type {};
+
+            template<typename T>
+            struct IsPrintable<T, decltype(void(std::declval<std::ostream&>() << std::declval<const T&>()))> : std::true_type {};
+
+            template<typename T>
+            inline void Show(std::ostream& out, const T& value);
+
+            inline void Show(std::ostream& out, const std::string& value)
+            {
+                  out << '"' << value << '"';
+            }
+
+            inline void Show(std::ostream& out, bool value)
+            {
+                  out << (value ? "true" : "false");
+            }
+
+            template<typename T, typename Allocator>
+            inline void Show(std::ostream& out, const std::vector<T, Allocator>& values)
+            {
+                  out << "[";
+                  for (std::size_t i = 0; i < values.size(); i++) {
+                        out << (i ? ", " : "");
+                        Show(out, static_cast<const T&>(values[i]));
+                  }
+                  out << "]";
+            }
+
+            template<typename T>
+            inline void ShowValue(std::ostream& out, const T& value, std::true_type)
+            {
+                  out << value;
+            }
+
+            template<typename T>
+            inline void ShowValue(std::ostream& out, const T&, std::false_type)
+            {
+                  out << "<value>";
+            }
+
+            template<typename T>
+            inline void Show(std::ostream& out, const T& value)
+            {
+                  ShowValue(out, value, IsPrintable<T>());
+            }
+
+            /**
+             * @brief Checks a property against generated cases.
+             *        Case i is always generated from MixSeed(seed, i), so the
+             *        cases can be spread over threads in any order and a
+             *        failure is reproduced by rerunning with the same seed.
+             */
+            template<typename Predicate, typename... Generators>
+            class PropertyCheck
+            {
+            public:
+                  typedef std::tuple<typename Generators::value_type...> Values;
+
+                  PropertyCheck(std::size_t cases, Predicate predicate, Generators... generators)
+                        : cases_(cases), predicate_(predicate), generators_(generators...) {}
+
+                  void operator()() const
+                  {
+                        const Options& options = GetOptions();
+                        const std::uint64_t seed = options.seed != 0 ? options.seed : FreshSeed();
+                        const std::size_t cases = cases_ != 0 ? cases_ : options.cases;
+                        const TestContext* test = CurrentContext();
+                        const std::size_t first = FirstFailure(seed, cases, test);
+
+                        if (first == kNoFailure) {
+                              Out() << "      [√] PASSED: Property held for " << cases << " cases (seed " << seed << ")"
+                                    << std::endl << std::endl;
+                              return;
+                        }
+
+                        Values values = Generate(seed, first, cases);
+                        std::string error;
+                        std::size_t steps = 0;
+                        {
+                              CaseScope scope(test);
+                              scope.Held(Holds(values, error), error);
+                              steps = ShrinkAll(scope, values, error, std::index_sequence_for<Generators...>());
+                        }
+
+                        std::ostringstream report;
+                        report << "Property falsified by case " << first << " of " << cases << " (seed " << seed
+                               << "), shrunk " << steps << " times to (";
+                        ShowAll(report, values, std::index_sequence_for<Generators...>());
+                        report << ")";
+                        if (!error.empty()) {
+                              report << ": " << error;
+                        }
+                        Fail(report.str());
+                  }
+
+            private:
+                  static const std::size_t kNoFailure = static_cast<std::size_t>(-1);
+                  static const std::size_t kChunk = 64;
+                  static const std::size_t kMaxSize = 100;
+                  static const std::size_t kMaxShrinkAttempts = 10000;
+
+                  Values Generate(std::uint64_t seed, std::size_t index, std::size_t cases) const
+                  {
+                        Random random(MixSeed(seed, index));
+                        const std::size_t size = 1 + index * kMaxSize / std::max<std::size_t>(cases, 1);
+                        return std::apply([&random, size](const Generators&... generators) {
+                              return Values{ generators.Generate(random, size)... };
+                        }, generators_);
+                  }
+
+                  bool Holds(const Values& values, std::string& error) const
+                  {
+                        try {
+                              return std::apply(predicate_, values);
+                        }
+                        catch (const std::exception& e) {
+                              error = e.what();
+                        }
+                        catch (...) {
+                              error = "Uncaught exception";
+                        }
+                        return false;
+                  }
+
+                  /** Lowest failing case, evaluated in chunks across all cores */
+                  std::size_t FirstFailure(std::uint64_t seed, std::size_t cases, const TestContext* test) const
+                  {
+                        std::atomic<std::size_t> next{0};
+                        std::atomic<std::size_t> failure{kNoFailure};
+
+                        auto worker = [&]() {
+                              CaseScope scope(test);
+                              for (std::size_t begin = next.fetch_add(kChunk); begin < cases && begin < failure.load(); begin = next.fetch_add(kChunk)) {
+                                    const std::size_t end = std::min(cases, begin + kChunk);
+                                    for (std::size_t i = begin; i < end && i < failure.load(); i++) {
+                                          std::string error;
+                                          if (!scope.Held(Holds(Generate(seed, i, cases), error), error)) {
+                                                std::size_t current = failure.load();
+                                                while (i < current && !failure.compare_exchange_weak(current, i)) {
+                                                }
+                                                break;
+                                          }
+                                    }
+                              }
+                        };
+
+                        const std::size_t chunks = (cases + kChunk - 1) / kChunk;
+                        const std::size_t threads = std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), chunks);
+                        std::vector<std::thread> pool;
+                        for (std::size_t i = 1; i < threads; i++) {
+                              pool.emplace_back(worker);
+                        }
+                        worker();
+                        for (auto& thread : pool) {
+                              thread.join();
+                        }
+                        return failure.load();
+                  }
+
+                  /** Replaces the I-th value with the first simpler candidate that still fails */
+                  template<std::size_t I>
+                  bool ShrinkAt(CaseScope& scope, Values& values, std::string& error, std::size_t& attempts) const
+                  {
+                        for (const auto& candidate : std::get<I>(generators_).Shrink(std::get<I>(values))) {
+                              if (++attempts > kMaxShrinkAttempts) {
+                                    return false;
+                              }
+                              Values trial = values;
+                              std::get<I>(trial) = candidate;
+                              std::string trial_error;
+                              if (!scope.Held(Holds(trial, trial_error), trial_error)) {
+                                    values = trial;
+                                    error = trial_error;
+                                    return true;
+                              }
+                        }
+                        return false;
+                  }
+
+                  template<std::size_t... I>
+                  std::size_t ShrinkAll(CaseScope& scope, Values& values, std::string& error, std::index_sequence<I...>) const
+                  {
+                        std::size_t steps = 0, attempts = 0;
+                        for (bool improved = true; improved; ) {
+                              improved = false;
+                              ((improved = improved || ShrinkAt<I>(scope, values, error, attempts)), ...);
+                              steps += improved;
+                        }
+                        return steps;
+                  }
+
+                  template<std::size_t... I>
+                  static void ShowAll(std::ostream& out, const Values& values, std::index_sequence<I...>)
+                  {
+                        ((out << (I ? ", " : ""), Show(out, std::get<I>(values))), ...);
+                  }
+
+                  std::size_t cases_;
+                  Predicate predicate_;
+                  std::tuple<Generators...> generators_;
+            };
+      }
+
+      /**
+       * @brief Defines a property test: a predicate that must hold for every
+       *        combination of generated arguments. Failing inputs are shrunk
+       *        to a minimal counterexample. Use unipp's assertion functions
+       *        (unipp::Equal, ...) or return false inside the predicate.
+       *        Cases run quietly, see detail::CaseScope.
+       *
+       *        PROPERTY("Reverse", "Reversing twice is the identity",
+       *              [](const std::vector<int>& v) { auto r = v; ...; return r == v; },
+       *              unipp::gen::VectorOf(unipp::gen::Int(-100, 100))
+       *        )
+       *
+       * @param cases Number of cases, 0 for --cases
+       */
+      template<typename Predicate, typename... Generators>
+      inline UnitTest Property(std::string name, std::string description, std::size_t cases,
+                               Predicate predicate, Generators... generators)
+      {
+            return UnitTest(name, description, detail::PropertyCheck<Predicate, Generators...>(cases, predicate, generators...));
+      }
+
+
+      /** Data driven tests */
+
+      /**
+       * @brief How a table file is laid out: text rows of delimited fields,
+       *        one per line, or binary records of a fixed size.
+       */
+      struct TableFormat
+      {
+            char delimiter = ',';
+            bool header = false;
+            std::size_t record_size = 0;
+      };
+
+      /** Lines of fields separated by delimiter, the first line skipped if it is a header */
+      inline TableFormat Delimited(char delimiter = ',', bool header = false)
+      {
+            TableFormat format;
+            format.delimiter = delimiter;
+            format.header = header;
+            return format;
+      }
+
+      /** Binary records of size bytes each */
+      inline TableFormat Records(std::size_t size)
+      {
+            TableFormat format;
+            format.record_size = size;
+            return format;
+      }
+
+      /**
+       * @brief One row of a table, a view into the mapped file. Fields are
+       *        found when asked for, nothing is copied or allocated, so the
+       *        row is only valid during the call it is handed to.
+       *
+       *        Quoted fields ("a, b") are returned without their quotes,
+       *        doubled quotes inside them are left as they are.
+       */
+      class Row
+      {
+      public:
+            Row(std::string_view text, char delimiter) : text_(text), delimiter_(delimiter) {}
+
+            /** The whole row, a line without its line break or a binary record */
+            std::string_view Text() const { return text_; }
+
+            std::size_t Size() const
+            {
+                  std::size_t fields = 0;
+                  for (std::size_t at = 0; at != std::string_view::npos; at = NextField(at)) {
+                        fields++;
+                  }
+                  return fields;
+            }
+
+            std::string_view operator[](std::size_t field) const
+            {
+                  std::size_t at = 0;
+                  for (std::size_t i = 0; i < field && at != std::string_view::npos; i++) {
+                        at = NextField(at);
+                  }
+                  if (at == std::string_view::npos) {
+                        throw std::out_of_range("the row has no field " + std::to_string(field) + ": " + std::string(text_));
+                  }
+                  const std::size_t next = NextField(at);
+                  std::string_view field_text = text_.substr(at, next == std::string_view::npos ? std::string_view::npos : next - 1 - at);
+                  if (field_text.size() >= 2 && field_text.front() == '"' && field_text.back() == '"') {
+                        field_text = field_text.substr(1, field_text.size() - 2);
+                  }
+                  return field_text;
+            }
+
+            /** A field parsed as T, a number or a string type */
+            template<typename T>
+            T Get(std::size_t field) const
+            {
+                  const std::string_view text = (*this)[field];
+                  if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string>) {
+                        return T(text);
+                  }
+                  else if constexpr (std::is_integral_v<T>) {
+                        T value{};
+                        const auto parsed = std::from_chars(text.data(), text.data() + text.size(), value);
+                        if (parsed.ec != std::errc() || parsed.ptr != text.data() + text.size()) {
+                              throw std::invalid_argument("field " + std::to_string(field) + " is not an integer: " + std::string(text));
+                        }
+                        return value;
+                  }
+                  else {
+                        static_assert(std::is_floating_point_v<T>, "Row::Get parses numbers and strings");
+                        char buffer[64];
+                        char* end = buffer;
+                        double value = 0;
+                        if (text.size() < sizeof(buffer)) {
+                              std::memcpy(buffer, text.data(), text.size());
+                              buffer[text.size()] = '\0';
+                              value = std::strtod(buffer, &end);
+                        }
+                        if (text.empty() || end != buffer + text.size()) {
+                              throw std::invalid_argument("field " + std::to_string(field) + " is not a number: " + std::string(text));
+                        }
+                        return static_cast<T>(value);
+                  }
+            }
+
+            /** A value of a binary record, copied from offset bytes into it */
+            template<typename T>
+            T Read(std::size_t offset) const
+            {
+                  static_assert(std::is_trivially_copyable_v<T>, "Row::Read copies plain values");
+                  if (offset + sizeof(T) > text_.size()) {
+                        throw std::out_of_range("reading " + std::to_string(sizeof(T)) + " bytes at " + std::to_string(offset)
+                              + " of a " + std::to_string(text_.size()) + " byte record");
+                  }
+                  T value;
+                  std::memcpy(&value, text_.data() + offset, sizeof(T));
+                  return value;
+            }
+
+      private:
+            /** Start of the field after the one starting at at, npos after the last */
+            std::size_t NextField(std::size_t at) const
+            {
+                  bool quoted = false;
+                  for (std::size_t i = at; i < text_.size(); i++) {
+                        if (text_[i] == '"') {
+                              quoted = !quoted;
+                        }
+                        else if (text_[i] == delimiter_ && !quoted) {
+                              return i + 1;
+                        }
+                  }
+                  return std::string_view::npos;
+            }
+
+            std::string_view text_;
+            char delimiter_;
+      };
+
+      namespace detail
+      {
+            /**
+             * @brief Failures of the cases of a test that runs many of them in
+             *        parallel: how many there were, and the messages of the
+             *        first few by position, whichever order they came in.
+             */
+            class FailureLog
+            {
+            public:
+                  static const std::size_t kKept = 10;
+
+                  void Add(std::size_t position, std::string message)
+                  {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        count_++;
+                        if (kept_.size() == kKept) {
+                              const auto highest = std::max_element(kept_.begin(), kept_.end());
+                              if (highest->first < position) {
+                                    return;
+                              }
+                              kept_.erase(highest);
+                        }
+                        kept_.emplace_back(position, message.empty() ? "returned false" : std::move(message));
+                  }
+
+                  std::size_t Count() const { return count_; }
+
+                  /** The kept failures, lowest position first */
+                  std::vector<std::pair<std::size_t, std::string>> First()
+                  {
+                        std::sort(kept_.begin(), kept_.end());
+                        return kept_;
+                  }
+
+            private:
+                  std::mutex mutex_;
+                  std::size_t count_ = 0;
+                  std::vector<std::pair<std::size_t, std::string>> kept_;
+            };
+
+            /**
+             * @brief Runs a body for every row of a memory-mapped table file.
+             *        The file is cut into chunks of whole rows, which are
+             *        handed out to one thread per core. Every row runs, and
+             *        the failures are reported by row number (the line, or
+             *        record, counting from 1), lowest first.
+             */
+            template<typename Body>
+            class TableCheck
+            {
+            public:
+                  TableCheck(std::string path, TableFormat format, Body body) : path_(std::move(path)), format_(format), body_(body) {}
+
+                  void operator()() const
+                  {
+                        const MappedFile file(path_);
+                        if (!file.Valid()) {
+                              Fail("Could not open the table " + path_);
+                              return;
+                        }
+
+                        const std::string_view data(file.Data(), file.Size());
+                        std::size_t begin = 0;
+                        if (format_.record_size == 0 && format_.header) {
+                              const std::size_t line = data.find('\n');
+                              begin = line == std::string_view::npos ? data.size() : line + 1;
+                        }
+                        else if (format_.record_size != 0 && data.size() % format_.record_size != 0) {
+                              Fail("The table " + path_ + " is " + std::to_string(data.size()) + " bytes, not a whole number of "
+                                   + std::to_string(format_.record_size) + " byte records");
+                              return;
+                        }
+
+                        std::atomic<std::size_t> next{begin};
+                        std::atomic<std::size_t> rows{0};
+                        FailureLog failures;
+                        const TestContext* test = CurrentContext();
+
+                        auto worker = [&]() {
+                              CaseScope scope(test);
+                              std::size_t local_rows = 0;
+                              for (std::size_t start = next.fetch_add(kChunk); start < data.size(); start = next.fetch_add(kChunk)) {
+                                    // A chunk owns the rows that start in it
+                                    std::size_t at = RowStart(data, start, begin);
+                                    const std::size_t end = std::min(data.size(), start + kChunk);
+                                    while (at < end) {
+                                          const std::size_t stop = RowEnd(data, at);
+                                          std::string_view text = data.substr(at, stop - at);
+                                          if (format_.record_size == 0 && !text.empty() && text.back() == '\r') {
+                                                text.remove_suffix(1);
+                                          }
+                                          if (!text.empty()) {
+                                                local_rows++;
+                                                std::string error;
+                                                if (!scope.Held(Holds(Row(text, format_.delimiter), error), error)) {
+                                                      failures.Add(at, error);
+                                                }
+                                          }
+                                          at = format_.record_size == 0 ? stop + 1 : stop;
+                                    }
+                              }
+                              rows += local_rows;
+                        };
+
+                        const std::size_t chunks = (data.size() - begin + kChunk - 1) / kChunk;
+                        const std::size_t threads = std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), std::max<std::size_t>(chunks, 1));
+                        std::vector<std::thread> pool;
+                        for (std::size_t i = 1; i < threads; i++) {
+                              pool.emplace_back(worker);
+                        }
+                        worker();
+                        for (auto& thread : pool) {
+                              thread.join();
+                        }
+
+                        if (failures.Count() == 0) {
+                              Out() << "      [√] PASSED: " << rows.load() << " rows of " << path_ << std::endl << std::endl;
+                              return;
+                        }
+
+                        std::ostringstream report;
+                        report << failures.Count() << " of " << rows.load() << " rows of " << path_ << " failed";
+                        std::size_t line = 1, counted = 0;
+                        for (const auto& failure : failures.First()) {
+                              if (format_.record_size == 0) {
+                                    line += static_cast<std::size_t>(std::count(data.begin() + counted, data.begin() + failure.first, '\n'));
+                                    counted = failure.first;
+                              }
+                              else {
+                                    line = failure.first / format_.record_size + 1;
+                              }
+                              report << "\n         row " << line << ": " << failure.second;
+                        }
+                        if (failures.Count() > FailureLog::kKept) {
+                              report << "\n         ...";
+                        }
+                        Fail(report.str());
+                  }
+
+            private:
+                  static const std::size_t kChunk = 256 * 1024;
+
+                  /** First row starting at or after offset */
+                  std::size_t RowStart(std::string_view data, std::size_t offset, std::size_t begin) const
+                  {
+                        if (offset <= begin) {
+                              return begin;
+                        }
+                        if (format_.record_size != 0) {
+                              return (offset + format_.record_size - 1) / format_.record_size * format_.record_size;
+                        }
+                        const std::size_t line = data.find('\n', offset - 1);
+                        return line == std::string_view::npos ? data.size() : line + 1;
+                  }
+
+                  std::size_t RowEnd(std::string_view data, std::size_t at) const
+                  {
+                        if (format_.record_size != 0) {
+                              return std::min(data.size(), at + format_.record_size);
+                        }
+                        const void* line = std::memchr(data.data() + at, '\n', data.size() - at);
+                        return line ? static_cast<std::size_t>(static_cast<const char*>(line) - data.data()) : data.size();
+                  }
+
+                  bool Holds(const Row& row, std::string& error) const
+                  {
+                        try {
+                              if constexpr (std::is_same_v<decltype(body_(row)), bool>) {
+                                    return body_(row);
+                              }
+                              else {
+                                    body_(row);
+                                    return true;
+                              }
+                        }
+                        catch (const std::exception& e) {
+                              error = e.what();
+                        }
+                        catch (...) {
+                              error = "Uncaught exception";
+                        }
+                        return false;
+                  }
+
+                  std::string path_;
+                  TableFormat format_;
+                  Body body_;
+            };
+      }
+
+      /**
+       * @brief Defines a data driven test: body runs for every row of a table
+       *        file (CSV, or fixed size binary records), in parallel. The
+       *        file is memory-mapped and rows are handed to body as views
+       *        into it, so a table of millions of rows costs one test, not
+       *        millions. As in property tests, body fails by throwing (use
+       *        unipp::Equal, ...) or by returning false. A failed ASSERT_*
+       *        in body fails the row too.
+       *
+       *        TABLE("Parse", "Parses every vector", "vectors.csv", [](const unipp::Row& row) {
+       *              unipp::Equal(Parse(row[0]), row.Get<double>(1));
+       *        })
+       */
+      template<typename Body>
+      inline UnitTest Table(std::string name, std::string description, std::string path, TableFormat format, Body body)
+      {
+            return UnitTest(name, description, detail::TableCheck<Body>(path, format, body)).Inputs({ path });
+      }
+
+
+      /** Value parameterized tests */
+
+      namespace param
+      {
+            /** The integers (or other arithmetic values) from begin up to, not including, end */
+            template<typename T>
+            class Range
+            {
+            public:
+                  typedef T value_type;
+
+                  Range(T begin, T end, T step = 1) : begin_(begin), step_(step), size_(0)
+                  {
+                        if (step > 0 && end > begin) {
+                              if constexpr (std::is_floating_point_v<T>) {
+                                    size_ = static_cast<std::size_t>(std::ceil((end - begin) / step));
+                              }
+                              else {
+                                    size_ = static_cast<std::size_t>((end - begin + step - 1) / step);
+                              }
+                        }
+                  }
+
+                  std::size_t Size() const { return size_; }
+                  T At(std::size_t index) const { return static_cast<T>(begin_ + static_cast<T>(index) * step_); }
+
+            private:
+                  T begin_;
+                  T step_;
+                  std::size_t size_;
+            };
+
+            /** A list of values */
+            template<typename T>
+            class Values
+            {
+            public:
+                  typedef T value_type;
+
+                  Values(std::initializer_list<T> values) : values_(std::make_shared<std::vector<T>>(values)) {}
+
+                  std::size_t Size() const { return values_->size(); }
+                  const T& At(std::size_t index) const { return (*values_)[index]; }
+
+            private:
+                  std::shared_ptr<const std::vector<T>> values_;
+            };
+
+            /**
+             * @brief Every combination of the values of some generators, as
+             *        tuples. Combination i is decoded from i, the last
+             *        generator varying fastest, so none are stored.
+             */
+            template<typename... Generators>
+            class Combine
+            {
+            public:
+                  typedef std::tuple<std::decay_t<decltype(std::declval<const Generators&>().At(0))>...> value_type;
+
+                  explicit Combine(Generators... generators) : generators_(generators...) {}
+
+                  std::size_t Size() const
+                  {
+                        return std::apply([](const Generators&... generators) {
+                              std::size_t size = 1;
+                              ((size *= generators.Size()), ...);
+                              return size;
+                        }, generators_);
+                  }
+
+                  value_type At(std::size_t index) const
+                  {
+                        return At(index, std::index_sequence_for<Generators...>());
+                  }
+
+            private:
+                  template<std::size_t... I>
+                  value_type At(std::size_t index, std::index_sequence<I...>) const
+                  {
+                        std::size_t digits[sizeof...(Generators)];
+                        for (std::size_t i = sizeof...(Generators); i-- > 0; ) {
+                              const std::size_t radix = Radix(i, std::index_sequence<I...>());
+                              digits[i] = index % radix;
+                              index /= radix;
+                        }
+                        return value_type(std::get<I>(generators_).At(digits[I])...);
+                  }
+
+                  template<std::size_t... I>
+                  std::size_t Radix(std::size_t which, std::index_sequence<I...>) const
+                  {
+                        const std::size_t sizes[] = { std::get<I>(generators_).Size()... };
+                        return sizes[which];
+                  }
+
+                  std::tuple<Generators...> generators_;
+            };
+      }
+
+      namespace detail
+      {
+            template<typename T>
+            struct IsTuple : std::false_type {};
+
+            template<typename... T>
+            struct IsTuple<std::tuple<T...>> : std::true_type {};
+
+            /**
+             * @brief Runs a body for each value of a generator. Values are made
+             *        from their index as the cases run, in chunks across all
+             *        cores, so a parameter space of millions of values is
+             *        never stored. Every case runs, failures are reported by
+             *        case (Name/index) with their value.
+             */
+            template<typename Generator, typename Body>
+            class ParameterizedCheck
+            {
+            public:
+                  typedef typename Generator::value_type Value;
+
+                  ParameterizedCheck(std::string name, Generator generator, Body body) : name_(std::move(name)), generator_(generator), body_(body) {}
+
+                  void operator()() const
+                  {
+                        const std::size_t cases = generator_.Size();
+                        std::atomic<std::size_t> next{0};
+                        FailureLog failures;
+                        const TestContext* test = CurrentContext();
+
+                        auto worker = [&]() {
+                              CaseScope scope(test);
+                              for (std::size_t begin = next.fetch_add(kChunk); begin < cases; begin = next.fetch_add(kChunk)) {
+                                    const std::size_t end = std::min(cases, begin + kChunk);
+                                    for (std::size_t i = begin; i < end; i++) {
+                                          std::string error;
+                                          if (!scope.Held(Holds(generator_.At(i), error), error)) {
+                                                failures.Add(i, error);
+                                          }
+                                    }
+                              }
+                        };
+
+                        const std::size_t chunks = (cases + kChunk - 1) / kChunk;
+                        const std::size_t threads = std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), std::max<std::size_t>(chunks, 1));
+                        std::vector<std::thread> pool;
+                        for (std::size_t i = 1; i < threads; i++) {
+                              pool.emplace_back(worker);
+                        }
+                        worker();
+                        for (auto& thread : pool) {
+                              thread.join();
+                        }
+
+                        if (failures.Count() == 0) {
+                              Out() << "      [√] PASSED: " << cases << " cases" << std::endl << std::endl;
+                              return;
+                        }
+
+                        std::ostringstream report;
+                        report << failures.Count() << " of " << cases << " cases failed";
+                        for (const auto& failure : failures.First()) {
+                              report << "\n         " << name_ << "/" << failure.first << " (";
+                              ShowCase(report, generator_.At(failure.first));
+                              report << "): " << failure.second;
+                        }
+                        if (failures.Count() > FailureLog::kKept) {
+                              report << "\n         ...";
+                        }
+                        Fail(report.str());
+                  }
+
+            private:
+                  static const std::size_t kChunk = 64;
+
+                  bool Holds(const Value& value, std::string& error) const
+                  {
+                        try {
+                              if constexpr (IsTuple<Value>::value) {
+                                    if constexpr (std::is_same_v<decltype(std::apply(body_, value)), bool>) {
+                                          return std::apply(body_, value);
+                                    }
+                                    else {
+                                          std::apply(body_, value);
+                                    }
+                              }
+                              else if constexpr (std::is_same_v<decltype(body_(value)), bool>) {
+                                    return body_(value);
+                              }
+                              else {
+                                    body_(value);
+                              }
+                              return true;
+                        }
+                        catch (const std::exception& e) {
+                              error = e.what();
+                        }
+                        catch (...) {
+                              error = "Uncaught exception";
+                        }
+                        return false;
+                  }
+
+                  static void ShowCase(std::ostream& out, const Value& value)
+                  {
+                        if constexpr (IsTuple<Value>::value) {
+                              std::apply([&out](const auto&... values) {
+                                    std::size_t i = 0;
+                                    ((out << (i++ ? ", " : ""), Show(out, values)), ...);
+                              }, value);
+                        }
+                        else {
+                              Show(out, value);
+                        }
+                  }
+
+                  std::string name_;
+                  Generator generator_;
+                  Body body_;
+            };
+      }
+
+      /**
+       * @brief Defines a value parameterized test: body runs once for every
+       *        value of a generator (a param::Range, param::Values, or the
+       *        param::Combine of several, whose tuples are spread over the
+       *        body's arguments). The values are made as the cases run,
+       *        never stored, so the test costs the same with a million of
+       *        them as with one. As in table tests, body fails by throwing
+       *        (use unipp::Equal, ...), by returning false or through a
+       *        failed ASSERT_*.
+       *
+       *        PARAMETERIZED("Pow", "Matches std::pow",
+       *              unipp::param::Combine(unipp::param::Range<int>(0, 1000), unipp::param::Values<int>({ 2, 3 })),
+       *              [](int base, int exponent) { unipp::Equal(Pow(base, exponent), std::pow(base, exponent)); }
+       *        )
+       */
+      template<typename Generator, typename Body>
+      inline UnitTest Parameterized(std::string name, std::string description, Generator generator, Body body)
+      {
+            return UnitTest(name, description, detail::ParameterizedCheck<Generator, Body>(name, generator, body));
+      }
+
+
+      /** Fuzzing */
+
+      /**
+       * @brief Read-only view of the bytes handed to a fuzz target.
+       */
+      struct ByteSpan
+      {
+            const std::uint8_t* data;
+            std::size_t size;
+
+            std::string String() const { return std::string(reinterpret_cast<const char*>(data), size); }
+      };
+
+      typedef std::function<void(ByteSpan)> FuzzFunction;
+
+      namespace detail
+      {
+            inline constexpr std::size_t kCoverageMapSize = 1 << 16;
+
+            /**
+             * @brief Edge hit counters filled by the coverage callbacks while a
+             *        fuzz target runs. All zero unless the binary is built with
+             *        UNIPP_FUZZ_COVERAGE and -fsanitize-coverage.
+             *
+             *        A plain global rather than a function local static: the
+             *        callbacks must not call anything that is instrumented.
+             */
+            struct Coverage
+            {
+                  std::uint8_t counters[kCoverageMapSize];
+                  volatile bool tracing;
+                  std::uint32_t guards;
+            };
+
+            inline Coverage coverage;
+
+            /** AFL style hit count buckets, so loops only count once per order of magnitude */
+            UNIPP_NO_COVERAGE inline std::uint8_t HitBucket(std::uint8_t hits)
+            {
+                  if (hits <= 3) {
+                        return hits == 3 ? 4 : hits;
+                  }
+                  return hits < 8 ? 8 : hits < 16 ? 16 : hits < 32 ? 32 : hits < 128 ? 64 : 128;
+            }
+
+            /**
+             * @brief State shared with the crash handler, which saves the input
+             *        that was running when the process received a fatal signal.
+             */
+            struct FuzzCrashState
+            {
+                  const std::uint8_t* data = nullptr;
+                  std::size_t size = 0;
+                  char directory[4096] = { 0 };
+            };
+
+            inline FuzzCrashState& CrashState()
+            {
+                  static FuzzCrashState state;
+                  return state;
+            }
+
+            inline std::string HexName(const char* prefix, std::uint64_t hash)
+            {
+                  static const char digits[] = "0123456789abcdef";
+                  std::string name = prefix;
+                  for (int shift = 60; shift >= 0; shift -= 4) {
+                        name += digits[(hash >> shift) & 0xF];
+                  }
+                  return name;
+            }
+
+#if defined(UNIPP_HAS_MMAP)
+            /** Async signal safe: no allocation, only open/write/close */
+            inline void FuzzCrashHandler(int signal)
+            {
+                  const FuzzCrashState& state = CrashState();
+                  if (state.data) {
+                        static const char digits[] = "0123456789abcdef";
+                        char path[4096 + 32];
+                        std::size_t length = 0;
+                        for (const char* c = state.directory; *c && length < 4096; c++) {
+                              path[length++] = *c;
+                        }
+                        const char prefix[] = "/crash-";
+                        for (const char* c = prefix; *c; c++) {
+                              path[length++] = *c;
+                        }
+                        const std::uint64_t hash = Hash(state.data, state.size);
+                        for (int shift = 60; shift >= 0; shift -= 4) {
+                              path[length++] = digits[(hash >> shift) & 0xF];
+                        }
+                        path[length] = '\0';
+
+                        const int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                        if (fd >= 0) {
+                              ssize_t written = ::write(fd, state.data, state.size);
+                              (void)written;
+                              ::close(fd);
+                        }
+                        const char message[] = "\n      [X] CRASHED: Fuzz target received a fatal signal, input saved to ";
+                        ssize_t written = ::write(STDERR_FILENO, message, sizeof(message) - 1);
+                        written = ::write(STDERR_FILENO, path, length);
+                        written = ::write(STDERR_FILENO, "\n", 1);
+                        (void)written;
+                  }
+                  ::signal(signal, SIG_DFL);
+                  ::raise(signal);
+            }
+#endif // UNIPP_HAS_MMAP
+
+            /**
+             * @brief libFuzzer style mutations, stacked a few at a time.
+             */
+            UNIPP_NO_COVERAGE inline void Mutate(std::vector<std::uint8_t>& input, const std::vector<std::vector<std::uint8_t>>& corpus,
+                               Random& random, std::size_t max_length)
+            {
+                  static const std::uint8_t interesting[] = { 0, 1, 0x7F, 0x80, 0xFF, 16, 32, 64, 100, 127 };
+                  const std::size_t count = 1 + random.Below(4);
+                  for (std::size_t m = 0; m < count; m++) {
+                        const std::size_t size = input.size();
+                        switch (random.Below(size == 0 ? 2 : 9)) {
+                              case 0:
+                              case 1: {
+                                    // Insert random bytes
+                                    const std::size_t amount = 1 + random.Below(8);
+                                    const std::size_t at = random.Below(size + 1);
+                                    for (std::size_t i = 0; i < amount && input.size() < max_length; i++) {
+                                          input.insert(input.begin() + at, static_cast<std::uint8_t>(random.Next()));
+                                    }
+                                    break;
+                              }
+                              case 2:
+                                    input[random.Below(size)] ^= static_cast<std::uint8_t>(1u << random.Below(8));
+                                    break;
+                              case 3:
+                                    input[random.Below(size)] = static_cast<std::uint8_t>(random.Next());
+                                    break;
+                              case 4:
+                                    input[random.Below(size)] = interesting[random.Below(sizeof(interesting))];
+                                    break;
+                              case 5:
+                                    input[random.Below(size)] += static_cast<std::uint8_t>(random.Between(-16, 16));
+                                    break;
+                              case 6: {
+                                    // Erase a range
+                                    const std::size_t at = random.Below(size);
+                                    const std::size_t amount = 1 + random.Below(std::min<std::size_t>(size - at, 16));
+                                    input.erase(input.begin() + at, input.begin() + at + amount);
+                                    break;
+                              }
+                              case 7: {
+                                    // Copy a chunk of the input over another part of it
+                                    const std::size_t from = random.Below(size);
+                                    const std::size_t to = random.Below(size);
+                                    const std::size_t amount = 1 + random.Below(std::min(size - from, size - to));
+                                    std::memmove(input.data() + to, input.data() + from, amount);
+                                    break;
+                              }
+                              default: {
+                                    // Splice in part of another corpus entry
+                                    const std::vector<std::uint8_t>& other = corpus[random.Below(corpus.size())];
+                                    if (other.empty()) {
+                                          break;
+                                    }
+                                    const std::size_t from = random.Below(other.size());
+                                    const std::size_t amount = 1 + random.Below(other.size() - from);
+                                    const std::size_t at = random.Below(size + 1);
+                                    input.insert(input.begin() + at, other.begin() + from, other.begin() + from + amount);
+                                    break;
+                              }
+                        }
+                  }
+                  if (input.size() > max_length) {
+                        input.resize(max_length);
+                  }
+            }
+
+            /**
+             * @brief Runs a fuzz target over one input.
+             *        Returns false (with the error) if the target threw.
+             */
+            UNIPP_NO_COVERAGE inline bool RunFuzzTarget(const FuzzFunction& target, const std::vector<std::uint8_t>& input, std::string& error)
+            {
+                  CrashState().data = input.data();
+                  CrashState().size = input.size();
+                  coverage.tracing = true;
+                  bool passed = true;
+                  try {
+                        target(ByteSpan{ input.data(), input.size() });
+                  }
+                  catch (const std::exception& e) {
+                        error = e.what();
+                        passed = false;
+                  }
+                  catch (...) {
+                        error = "Uncaught exception";
+                        passed = false;
+                  }
+                  coverage.tracing = false;
+                  CrashState().data = nullptr;
+                  return passed;
+            }
+
+            /** Folds the last run's counters into the seen ones, true if anything new showed up */
+            UNIPP_NO_COVERAGE inline bool MergeCoverage(std::vector<std::uint8_t>& seen)
+            {
+                  bool novel = false;
+                  for (std::size_t i = 0; i < kCoverageMapSize; i++) {
+                        // Most of the map is untouched, skip it a word at a time
+                        std::uint64_t word;
+                        if (i % 8 == 0 && (std::memcpy(&word, coverage.counters + i, sizeof(word)), word == 0)) {
+                              i += 7;
+                              continue;
+                        }
+                        if (coverage.counters[i]) {
+                              const std::uint8_t bucket = HitBucket(coverage.counters[i]);
+                              novel |= (seen[i] & bucket) == 0;
+                              seen[i] |= bucket;
+                              coverage.counters[i] = 0;
+                        }
+                  }
+                  return novel;
+            }
+
+            inline std::string SaveInput(const std::string& directory, const char* prefix, const std::vector<std::uint8_t>& input)
+            {
+                  std::error_code ignored;
+                  std::filesystem::create_directories(directory, ignored);
+                  const std::string path = directory + "/" + HexName(prefix, Hash(input.data(), input.size()));
+                  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+                  file.write(reinterpret_cast<const char*>(input.data()), static_cast<std::streamsize>(input.size()));
+                  return path;
+            }
+
+            inline std::vector<std::pair<std::string, std::vector<std::uint8_t>>> LoadCorpus(const std::string& directory)
+            {
+                  std::vector<std::pair<std::string, std::vector<std::uint8_t>>> inputs;
+                  std::error_code error;
+                  for (std::filesystem::directory_iterator entry(directory, error), end; !error && entry != end; entry.increment(error)) {
+                        if (entry->is_regular_file()) {
+                              MappedFile file(entry->path().string());
+                              inputs.emplace_back(entry->path().string(), std::vector<std::uint8_t>(file.Data(), file.Data() + file.Size()));
+                        }
+                  }
+                  std::sort(inputs.begin(), inputs.end());
+                  return inputs;
+            }
+
+            /**
+             * @brief Body of a FUZZ test.
+             *        Normally replays every input of its corpus directory, saved
+             *        crashes included, as a regression test. With --fuzz
+             *        matching its name it mutates inputs instead, keeping those
+             *        that reach new coverage and saving the first crash.
+             */
+            class FuzzTest
+            {
+            public:
+                  FuzzTest(std::string name, FuzzFunction target, std::string corpus)
+                        : name_(name), target_(target), corpus_(corpus) {}
+
+                  void operator()() const
+                  {
+                        const Options& options = GetOptions();
+                        const std::string directory = Directory(options);
+                        if (options.fuzz == "*" || options.fuzz == name_) {
+                              Fuzz(directory, options);
+                        }
+                        else {
+                              Replay(directory);
+                        }
+                  }
+
+            private:
+                  std::string Directory(const Options& options) const
+                  {
+                        if (!corpus_.empty()) {
+                              return corpus_;
+                        }
+                        std::string sanitized = name_;
+                        for (char& c : sanitized) {
+                              c = std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '.' ? c : '_';
+                        }
+                        return options.corpus + "/" + sanitized;
+                  }
+
+                  void Replay(const std::string& directory) const
+                  {
+                        auto inputs = LoadCorpus(directory);
+                        inputs.emplace_back("<empty input>", std::vector<std::uint8_t>());
+                        for (const auto& input : inputs) {
+                              std::string error;
+                              if (!RunFuzzTarget(target_, input.second, error)) {
+                                    Fail("Fuzz target failed on " + input.first + ": " + error);
+                                    return;
+                              }
+                        }
+                        Out() << "      [√] PASSED: Replayed " << inputs.size() << " inputs" << std::endl << std::endl;
+                  }
+
+                  void Fuzz(const std::string& directory, const Options& options) const
+                  {
+#if defined(UNIPP_HAS_MMAP)
+                        std::strncpy(CrashState().directory, directory.c_str(), sizeof(CrashState().directory) - 1);
+                        std::error_code ignored;
+                        std::filesystem::create_directories(directory, ignored);
+                        const int signals[] = { SIGSEGV, SIGABRT, SIGFPE, SIGILL, SIGBUS };
+                        for (int signal : signals) {
+                              ::signal(signal, FuzzCrashHandler);
+                        }
+#endif // UNIPP_HAS_MMAP
+
+                        std::vector<std::vector<std::uint8_t>> corpus;
+                        for (auto& input : LoadCorpus(directory)) {
+                              corpus.push_back(input.second);
+                        }
+                        if (corpus.empty()) {
+                              corpus.push_back(std::vector<std::uint8_t>());
+                        }
+
+                        std::vector<std::uint8_t> seen(kCoverageMapSize, 0);
+                        std::string error;
+                        bool crashed = false;
+                        std::vector<std::uint8_t> input;
+                        for (const auto& entry : corpus) {
+                              if (!RunFuzzTarget(target_, entry, error)) {
+                                    crashed = true;
+                                    input = entry;
+                                    break;
+                              }
+                              MergeCoverage(seen);
+                        }
+
+                        Random random(options.seed != 0 ? options.seed : FreshSeed());
+                        const auto start = std::chrono::steady_clock::now();
+                        const auto deadline = start + std::chrono::seconds(options.fuzz_time);
+                        std::size_t runs = 0, found = 0;
+                        while (!crashed && (options.fuzz_runs == 0 || runs < options.fuzz_runs)
+                               && (options.fuzz_time == 0 || (runs % 256 != 0 || std::chrono::steady_clock::now() < deadline))) {
+                              input = corpus[random.Below(corpus.size())];
+                              Mutate(input, corpus, random, options.fuzz_max_len);
+                              runs++;
+                              if (!RunFuzzTarget(target_, input, error)) {
+                                    crashed = true;
+                              }
+                              else if (MergeCoverage(seen)) {
+                                    corpus.push_back(input);
+                                    SaveInput(directory, "input-", input);
+                                    found++;
+                              }
+                        }
+
+#if defined(UNIPP_HAS_MMAP)
+                        for (int signal : signals) {
+                              ::signal(signal, SIG_DFL);
+                        }
+#endif // UNIPP_HAS_MMAP
+
+                        const std::size_t edges = static_cast<std::size_t>(std::count_if(seen.begin(), seen.end(), [](std::uint8_t hits) { return hits != 0; }));
+                        Out() << "      [+] Fuzzed " << runs << " inputs in " << FormatMilliseconds(std::chrono::steady_clock::now() - start)
+                              << ", corpus of " << corpus.size() << " (" << found << " new), " << edges << " edges" << std::endl;
+                        if (crashed) {
+                              Fail("Fuzz target failed: " + error + ", input saved to " + SaveInput(directory, "crash-", input));
+                        }
+                        else {
+                              Out() << "      [√] PASSED" << std::endl << std::endl;
+                        }
+                  }
+
+                  std::string name_;
+                  FuzzFunction target_;
+                  std::string corpus_;
+            };
+      }
+
+      /**
+       * @brief Defines a fuzz test over a target taking a ByteSpan.
+       *
+       *        FUZZ("Parser", "Parses arbitrary input", [](unipp::ByteSpan input) {
+       *              Parse(input.data, input.size);
+       *        })
+       *
+       *        Regular runs replay the inputs in its corpus directory
+       *        (--corpus/<name> unless given), --fuzz=<name> fuzzes it.
+       */
+      inline UnitTest Fuzz(std::string name, std::string description, FuzzFunction target, std::string corpus = "")
+      {
+            return UnitTest(name, description, detail::FuzzTest(name, target, corpus));
+      }
+
+
+      /** Interleaving exploration */
+
+      namespace detail
+      {
+            /** One logical time per simulated thread, for happens-before */
+            struct VectorClock
+            {
+                  std::vector<std::size_t> times;
+
+                  std::size_t Get(std::size_t thread) const
+                  {
+                        return thread < times.size() ? times[thread] : 0;
+                  }
+
+                  void Tick(std::size_t thread)
+                  {
+                        if (times.size() <= thread) {
+                              times.resize(thread + 1, 0);
+                        }
+                        times[thread]++;
+                  }
+
+                  void Join(const VectorClock& other)
+                  {
+                        if (times.size() < other.times.size()) {
+                              times.resize(other.times.size(), 0);
+                        }
+                        for (std::size_t i = 0; i < other.times.size(); i++) {
+                              times[i] = std::max(times[i], other.times[i]);
+                        }
+                  }
+            };
+
+            inline bool IsAcquire(std::memory_order order)
+            {
+                  return order == std::memory_order_acquire || order == std::memory_order_consume
+                         || order == std::memory_order_acq_rel || order == std::memory_order_seq_cst;
+            }
+
+            inline bool IsRelease(std::memory_order order)
+            {
+                  return order == std::memory_order_release || order == std::memory_order_acq_rel || order == std::memory_order_seq_cst;
+            }
+
+            /** Thrown at scheduling points to unwind the threads of an abandoned schedule */
+            struct AbandonSchedule {};
+
+            enum class SimOp { Spawn, Join, Yield, Load, StaleLoad, Store, Rmw, Lock, Unlock };
+
+            inline const char* ToString(SimOp op)
+            {
+                  switch (op) {
+                        case SimOp::Spawn: return "spawn";
+                        case SimOp::Join: return "join";
+                        case SimOp::Yield: return "yield";
+                        case SimOp::Load: return "load";
+                        case SimOp::StaleLoad: return "load (stale value)";
+                        case SimOp::Store: return "store";
+                        case SimOp::Rmw: return "read-modify-write";
+                        case SimOp::Lock: return "lock";
+                        case SimOp::Unlock: return "unlock";
+                  }
+                  return "?";
+            }
+
+            /**
+             * @brief A choice the scheduler leaves to the strategy: which
+             *        thread runs next, or which of the values an atomic load
+             *        may see it reads (0 is the latest).
+             */
+            struct Decision
+            {
+                  std::size_t index;
+                  std::size_t step;
+                  std::size_t current;
+                  bool threads;
+                  std::vector<std::size_t> alternatives;
+                  std::size_t preferred;
+            };
+
+            /** Decides every choice of a schedule */
+            class Strategy
+            {
+            public:
+                  virtual ~Strategy() = default;
+                  virtual void ThreadCreated(std::size_t) {}
+                  virtual std::size_t Choose(const Decision& decision) = 0;
+            };
+
+            /**
+             * @brief Systematic search of every schedule that deviates from
+             *        the default one at most bound times, depth first. The
+             *        default keeps running the current thread, so this is
+             *        preemption bounding (switching away from a blocked
+             *        thread is free), with stale reads counting as
+             *        deviations too.
+             */
+            class BoundedSearch : public Strategy
+            {
+            public:
+                  explicit BoundedSearch(std::size_t bound) : bound_(bound) {}
+
+                  void Begin()
+                  {
+                        position_ = 0;
+                  }
+
+                  std::size_t Choose(const Decision& decision) override
+                  {
+                        std::vector<std::size_t> order{ decision.preferred };
+                        for (std::size_t alternative : decision.alternatives) {
+                              if (alternative != decision.preferred) {
+                                    order.push_back(alternative);
+                              }
+                        }
+                        const bool free = decision.threads
+                              && std::find(decision.alternatives.begin(), decision.alternatives.end(), decision.current) == decision.alternatives.end();
+
+                        if (position_ < path_.size() && path_[position_].order != order) {
+                              path_.resize(position_); // The code under test is not deterministic, carry on from here
+                        }
+                        if (position_ == path_.size()) {
+                              path_.push_back({ order, 0, free });
+                        }
+                        return path_[position_++].Choice();
+                  }
+
+                  /** Moves on to the next schedule, false once they were all tried */
+                  bool Advance()
+                  {
+                        path_.resize(std::min(path_.size(), position_));
+                        std::size_t deviations = 0;
+                        for (const auto& entry : path_) {
+                              deviations += entry.rank > 0 && !entry.free;
+                        }
+                        while (!path_.empty()) {
+                              Entry& last = path_.back();
+                              deviations -= last.rank > 0 && !last.free;
+                              if (last.rank + 1 < last.order.size() && (last.free || deviations < bound_)) {
+                                    last.rank++;
+                                    return true;
+                              }
+                              path_.pop_back();
+                        }
+                        return false;
+                  }
+
+            private:
+                  struct Entry
+                  {
+                        std::vector<std::size_t> order;
+                        std::size_t rank;
+                        bool free;
+
+                        std::size_t Choice() const { return order[rank]; }
+                  };
+
+                  std::size_t bound_;
+                  std::size_t position_ = 0;
+                  std::vector<Entry> path_;
+            };
+
+            /**
+             * @brief PCT (probabilistic concurrency testing): threads get
+             *        random priorities and the highest enabled one runs,
+             *        except that at depth - 1 random steps the running thread
+             *        drops below every other. Finds any bug needing depth
+             *        ordering constraints with a known minimum probability.
+             */
+            class PriorityStrategy : public Strategy
+            {
+            public:
+                  PriorityStrategy(std::uint64_t seed, std::size_t expected_steps, std::size_t depth = 3) : random_(seed), depth_(depth)
+                  {
+                        for (std::size_t i = 1; i < depth; i++) {
+                              change_points_.push_back(1 + random_.Below(std::max<std::size_t>(1, expected_steps)));
+                        }
+                        std::sort(change_points_.begin(), change_points_.end());
+                  }
+
+                  void ThreadCreated(std::size_t thread) override
+                  {
+                        priorities_[thread] = depth_ + random_.Below(1u << 20);
+                  }
+
+                  std::size_t Choose(const Decision& decision) override
+                  {
+                        if (!decision.threads) {
+                              return random_.Below(2) == 0 ? 0 : decision.alternatives[random_.Below(decision.alternatives.size())];
+                        }
+                        while (next_change_ < change_points_.size() && decision.step >= change_points_[next_change_]) {
+                              priorities_[decision.current] = ++next_change_;
+                        }
+                        // A thread the default schedule moves away from is spinning, the others go first
+                        const bool yielding = decision.preferred != decision.current;
+                        std::size_t best = decision.preferred;
+                        for (std::size_t alternative : decision.alternatives) {
+                              if (!(yielding && alternative == decision.current) && priorities_[alternative] > priorities_[best]) {
+                                    best = alternative;
+                              }
+                        }
+                        return best;
+                  }
+
+            private:
+                  Random random_;
+                  std::size_t depth_;
+                  std::vector<std::size_t> change_points_;
+                  std::size_t next_change_ = 0;
+                  std::map<std::size_t, std::size_t> priorities_;
+            };
+
+            /** Replays a schedule given as the choices that differ from the defaults */
+            class ReplayStrategy : public Strategy
+            {
+            public:
+                  explicit ReplayStrategy(const std::string& schedule)
+                  {
+                        std::stringstream entries(schedule == "none" ? "" : schedule);
+                        std::string entry;
+                        while (std::getline(entries, entry, ',')) {
+                              const std::size_t colon = entry.find(':');
+                              if (colon == std::string::npos) {
+                                    throw std::invalid_argument("invalid schedule " + schedule);
+                              }
+                              choices_[std::stoull(entry.substr(0, colon))] = std::stoull(entry.substr(colon + 1));
+                        }
+                  }
+
+                  std::size_t Choose(const Decision& decision) override
+                  {
+                        const auto choice = choices_.find(decision.index);
+                        return choice == choices_.end() ? decision.preferred : choice->second;
+                  }
+
+            private:
+                  std::map<std::size_t, std::size_t> choices_;
+            };
+
+            /**
+             * @brief Runs a test body as a simulated program: threads spawned
+             *        through unipp::sim are real threads, but only one runs at
+             *        a time and they only switch at the operations of the
+             *        sim primitives, where the strategy picks who goes next.
+             *        Atomic loads may also read values other threads stored
+             *        earlier, as far as the memory orders allow, and
+             *        unsynchronised accesses to sim::Var are reported as data
+             *        races.
+             */
+            class Scheduler
+            {
+            public:
+                  static const std::size_t kNone = static_cast<std::size_t>(-1);
+                  static const std::size_t kMaxSteps = 100000;
+                  static const std::size_t kSpinLoads = 3;
+                  static const std::size_t kTraceLength = 32;
+
+                  enum class State { Runnable, BlockedOnMutex, BlockedOnJoin, Finished };
+
+                  struct Thread
+                  {
+                        std::size_t id = 0;
+                        State state = State::Runnable;
+                        const void* waiting_on = nullptr;
+                        std::size_t joining = 0;
+                        bool yielding = false;
+                        bool unwinding = false;
+                        std::size_t loads = 0;
+                        VectorClock clock;
+                        std::condition_variable wake;
+                        std::thread os;
+                  };
+
+                  Scheduler(Strategy& strategy, TestContext* context) : strategy_(strategy), context_(context)
+                  {
+                        static std::atomic<std::size_t> generations{0};
+                        generation_ = ++generations;
+                  }
+
+                  Scheduler(const Scheduler&) = delete;
+                  Scheduler& operator=(const Scheduler&) = delete;
+
+                  /** The scheduler the calling thread is simulated by, if any */
+                  static Scheduler*& Current()
+                  {
+                        static thread_local Scheduler* scheduler = nullptr;
+                        return scheduler;
+                  }
+
+                  static std::size_t& CurrentThread()
+                  {
+                        static thread_local std::size_t thread = 0;
+                        return thread;
+                  }
+
+                  /** Runs the body as thread 0, then every thread it spawned to the end */
+                  void Run(const TestFunction& body)
+                  {
+                        threads_.push_back(std::make_unique<Thread>());
+                        threads_[0]->clock.Tick(0);
+                        strategy_.ThreadCreated(0);
+                        active_ = 0;
+                        Current() = this;
+                        CurrentThread() = 0;
+                        RunThread(body);
+                        {
+                              std::unique_lock<std::mutex> lock(mutex_);
+                              threads_[0]->wake.wait(lock, [this]() { return finished_ == threads_.size(); });
+                        }
+                        for (auto& thread : threads_) {
+                              if (thread->os.joinable()) {
+                                    thread->os.join();
+                              }
+                        }
+                        Current() = nullptr;
+                  }
+
+                  /** Tells schedules apart, sim objects reset their state when a new one first uses them */
+                  std::size_t Generation() const { return generation_; }
+                  Thread& Me() { return *threads_[CurrentThread()]; }
+                  bool Abandoning() const { return abandoning_; }
+                  std::size_t Steps() const { return steps_; }
+                  std::size_t Preemptions() const { return preemptions_; }
+
+                  /** The choices this schedule made that differ from the defaults, for --replay */
+                  std::string Schedule() const { return schedule_.empty() ? "none" : schedule_; }
+
+                  /**
+                   * @brief A scheduling point, right before the current thread
+                   *        performs op on object. Unless unwind is false (the
+                   *        operation may run in a destructor), it throws
+                   *        AbandonSchedule once the schedule is abandoned.
+                   */
+                  void Point(SimOp op, const void* object, bool unwind = true)
+                  {
+                        abandoning_ = abandoning_ || Failed();
+                        if (abandoning_) {
+                              Unwind(unwind);
+                              return;
+                        }
+                        if (++steps_ > kMaxSteps) {
+                              Abandon("Schedule ran for more than " + std::to_string(kMaxSteps) + " steps, is something spinning without sim::Yield?");
+                              Unwind(unwind);
+                              return;
+                        }
+
+                        Thread& me = Me();
+                        if (op == SimOp::Load) {
+                              if (++me.loads >= kSpinLoads) {
+                                    me.yielding = true;
+                                    me.loads = 0;
+                              }
+                        }
+                        else {
+                              me.loads = 0;
+                              me.yielding = me.yielding || op == SimOp::Yield;
+                        }
+
+                        // Other operations are recorded once this thread is back to perform them, a yield is the switch itself
+                        if (op == SimOp::Yield) {
+                              Record(op, object);
+                        }
+                        const std::vector<std::size_t> enabled = Enabled();
+                        if (enabled.size() > 1) {
+                              SwitchTo(Decide(true, enabled, Preferred(enabled), me.id), unwind);
+                        }
+                        if (op != SimOp::Yield && !abandoning_) {
+                              Record(op, object);
+                        }
+                  }
+
+                  /** Picks which of count values (0 the latest) an atomic load reads */
+                  std::size_t ChooseValue(std::size_t count)
+                  {
+                        if (count <= 1 || abandoning_) {
+                              return 0;
+                        }
+                        std::vector<std::size_t> alternatives;
+                        for (std::size_t i = 0; i < count; i++) {
+                              alternatives.push_back(i);
+                        }
+                        const std::size_t choice = Decide(false, alternatives, 0, CurrentThread());
+                        if (choice > 0 && !trace_.empty()) {
+                              trace_.back().op = SimOp::StaleLoad;
+                        }
+                        return choice;
+                  }
+
+                  std::size_t Spawn(TestFunction function)
+                  {
+                        Point(SimOp::Spawn, nullptr);
+                        Thread& parent = Me();
+                        std::size_t id;
+                        {
+                              std::lock_guard<std::mutex> lock(mutex_);
+                              id = threads_.size();
+                              threads_.push_back(std::make_unique<Thread>());
+                              threads_[id]->id = id;
+                              threads_[id]->clock = parent.clock;
+                              threads_[id]->clock.Tick(id);
+                        }
+                        parent.clock.Tick(parent.id);
+                        strategy_.ThreadCreated(id);
+
+                        TestContext* context = context_;
+                        threads_[id]->os = std::thread([this, id, function, context]() {
+                              Current() = this;
+                              CurrentThread() = id;
+                              CurrentContext() = context;
+                              {
+                                    std::unique_lock<std::mutex> lock(mutex_);
+                                    Thread& me = *threads_[id];
+                                    me.wake.wait(lock, [this, id]() { return active_ == id; });
+                              }
+                              RunThread(function);
+                        });
+                        return id;
+                  }
+
+                  void Join(std::size_t thread, bool unwind)
+                  {
+                        Point(SimOp::Join, nullptr, unwind);
+                        Thread& me = Me();
+                        while (threads_[thread]->state != State::Finished) {
+                              me.state = State::BlockedOnJoin;
+                              me.joining = thread;
+                              if (abandoning_) {
+                                    SwitchTo(thread, unwind); // Let it unwind first, it may use what is about to be destroyed here
+                              }
+                              else {
+                                    Reschedule(unwind);
+                              }
+                        }
+                        me.state = State::Runnable;
+                        me.clock.Join(threads_[thread]->clock);
+                  }
+
+                  /** Mutexes simulated as a holder and the clock of their last unlock */
+                  struct MutexState
+                  {
+                        std::size_t holder = kNone;
+                        VectorClock clock;
+                  };
+
+                  bool Lock(MutexState& mutex, bool wait)
+                  {
+                        Point(SimOp::Lock, &mutex);
+                        Thread& me = Me();
+                        while (mutex.holder != kNone) {
+                              if (!wait || abandoning_) {
+                                    return false;
+                              }
+                              me.state = State::BlockedOnMutex;
+                              me.waiting_on = &mutex;
+                              Reschedule(true);
+                        }
+                        mutex.holder = me.id;
+                        me.clock.Join(mutex.clock);
+                        return true;
+                  }
+
+                  void Unlock(MutexState& mutex)
+                  {
+                        Point(SimOp::Unlock, &mutex, false);
+                        Thread& me = Me();
+                        if (mutex.holder != me.id) {
+                              return;
+                        }
+                        mutex.clock = me.clock;
+                        me.clock.Tick(me.id);
+                        mutex.holder = kNone;
+                        for (auto& thread : threads_) {
+                              if (thread->state == State::BlockedOnMutex && thread->waiting_on == &mutex) {
+                                    thread->state = State::Runnable;
+                              }
+                        }
+                  }
+
+                  /** Throws through the current thread once, when the schedule is abandoned */
+                  void Unwind(bool unwind = true)
+                  {
+                        Thread& me = Me();
+                        if (unwind && abandoning_ && !me.unwinding) {
+                              me.unwinding = true;
+                              throw AbandonSchedule();
+                        }
+                  }
+
+                  /** Fails the test and unwinds every thread */
+                  void Abandon(const std::string& message)
+                  {
+                        if (!abandoning_) {
+                              Fail(message);
+                              abandoning_ = true;
+                        }
+                  }
+
+                  /** Object numbers, in the order objects are first used, for traces */
+                  std::size_t ObjectId(const void* object)
+                  {
+                        return objects_.emplace(object, objects_.size() + 1).first->second;
+                  }
+
+                  /** The last steps of the schedule, for failure reports */
+                  std::string Trace()
+                  {
+                        std::ostringstream text;
+                        if (steps_ > trace_.size()) {
+                              text << "         ... " << steps_ - trace_.size() << " earlier steps" << std::endl;
+                        }
+                        for (const auto& step : trace_) {
+                              text << "         thread " << step.thread << ": " << ToString(step.op);
+                              if (step.object) {
+                                    text << " #" << ObjectId(step.object);
+                              }
+                              text << std::endl;
+                        }
+                        return text.str();
+                  }
+
+            private:
+                  struct Step
+                  {
+                        std::size_t thread;
+                        SimOp op;
+                        const void* object;
+                  };
+
+                  void Record(SimOp op, const void* object)
+                  {
+                        if (trace_.size() == kTraceLength) {
+                              trace_.pop_front();
+                        }
+                        trace_.push_back({ CurrentThread(), op, object });
+                        if (object) {
+                              ObjectId(object);
+                        }
+                  }
+
+                  void RunThread(const TestFunction& function)
+                  {
+                        try {
+                              if (!abandoning_) {
+                                    function();
+                              }
+                        }
+                        catch (const AbandonSchedule&) {
+                        }
+                        catch (const std::exception& e) {
+                              Fail(std::string("Uncaught exception in thread ") + std::to_string(CurrentThread()) + ": " + e.what());
+                        }
+                        catch (...) {
+                              Fail("Uncaught exception in thread " + std::to_string(CurrentThread()));
+                        }
+                        Exit();
+                  }
+
+                  std::vector<std::size_t> Enabled() const
+                  {
+                        std::vector<std::size_t> enabled;
+                        for (const auto& thread : threads_) {
+                              if (thread->state == State::Runnable) {
+                                    enabled.push_back(thread->id);
+                              }
+                        }
+                        return enabled;
+                  }
+
+                  /** Keep running the current thread, unless it is blocked or yields: then the next one round robin */
+                  std::size_t Preferred(const std::vector<std::size_t>& enabled) const
+                  {
+                        const std::size_t current = CurrentThread();
+                        const bool can_continue = std::find(enabled.begin(), enabled.end(), current) != enabled.end();
+                        if (can_continue && !threads_[current]->yielding) {
+                              return current;
+                        }
+                        for (std::size_t thread : enabled) {
+                              if (thread > current) {
+                                    return thread;
+                              }
+                        }
+                        return enabled.front() == current && enabled.size() > 1 ? enabled[1] : enabled.front();
+                  }
+
+                  std::size_t Decide(bool threads, const std::vector<std::size_t>& alternatives, std::size_t preferred, std::size_t current)
+                  {
+                        Decision decision{ decisions_++, steps_, current, threads, alternatives, preferred };
+                        std::size_t choice = strategy_.Choose(decision);
+                        if (std::find(alternatives.begin(), alternatives.end(), choice) == alternatives.end()) {
+                              choice = preferred;
+                        }
+                        if (choice != preferred) {
+                              schedule_ += (schedule_.empty() ? "" : ",") + std::to_string(decision.index) + ":" + std::to_string(choice);
+                        }
+                        if (threads && choice != current && std::find(alternatives.begin(), alternatives.end(), current) != alternatives.end()) {
+                              preemptions_ += !threads_[current]->yielding;
+                        }
+                        return choice;
+                  }
+
+                  /** Hands the baton to next and waits to get it back */
+                  void SwitchTo(std::size_t next, bool unwind)
+                  {
+                        const std::size_t me = CurrentThread();
+                        if (next == me) {
+                              return;
+                        }
+                        threads_[me]->yielding = false;
+                        {
+                              std::unique_lock<std::mutex> lock(mutex_);
+                              active_ = next;
+                              threads_[next]->wake.notify_one();
+                              threads_[me]->wake.wait(lock, [this, me]() { return active_ == me; });
+                        }
+                        Unwind(unwind);
+                  }
+
+                  /** Switches away from the current thread, which cannot go on */
+                  void Reschedule(bool unwind)
+                  {
+                        const std::vector<std::size_t> enabled = Enabled();
+                        if (enabled.empty()) {
+                              Abandon("Deadlock: " + Blocked());
+                              Unwind(unwind);
+                              return;
+                        }
+                        SwitchTo(enabled.size() == 1 ? enabled[0] : Decide(true, enabled, Preferred(enabled), CurrentThread()), unwind);
+                  }
+
+                  std::string Blocked() const
+                  {
+                        std::string text;
+                        for (const auto& thread : threads_) {
+                              if (thread->state == State::BlockedOnMutex || thread->state == State::BlockedOnJoin) {
+                                    text += (text.empty() ? "" : ", ") + std::string("thread ") + std::to_string(thread->id)
+                                          + (thread->state == State::BlockedOnMutex ? " waits for a mutex" : " joins thread " + std::to_string(thread->joining));
+                              }
+                        }
+                        return text;
+                  }
+
+                  /** Ends the current thread, passing the baton on for good */
+                  void Exit()
+                  {
+                        Thread& me = Me();
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        me.state = State::Finished;
+                        finished_++;
+                        for (auto& thread : threads_) {
+                              if (thread->state == State::BlockedOnJoin && thread->joining == me.id) {
+                                    thread->state = State::Runnable;
+                              }
+                        }
+                        if (finished_ == threads_.size()) {
+                              active_ = kNone;
+                              threads_[0]->wake.notify_all();
+                              return;
+                        }
+
+                        std::size_t next = kNone;
+                        const std::vector<std::size_t> enabled = Enabled();
+                        if (!abandoning_ && !enabled.empty()) {
+                              next = enabled.size() == 1 ? enabled[0] : Decide(true, enabled, Preferred(enabled), me.id);
+                        }
+                        else {
+                              if (!abandoning_) {
+                                    Abandon("Deadlock: " + Blocked());
+                              }
+                              for (const auto& thread : threads_) {
+                                    if (thread->state != State::Finished) {
+                                          next = thread->id;
+                                          break;
+                                    }
+                              }
+                        }
+                        active_ = next;
+                        threads_[next]->wake.notify_one();
+                  }
+
+                  Strategy& strategy_;
+                  TestContext* context_;
+                  std::size_t generation_;
+                  std::mutex mutex_;
+                  std::vector<std::unique_ptr<Thread>> threads_;
+                  std::size_t active_ = 0;
+                  std::size_t finished_ = 0;
+                  std::size_t steps_ = 0;
+                  std::size_t decisions_ = 0;
+                  std::size_t preemptions_ = 0;
+                  bool abandoning_ = false;
+                  std::string schedule_;
+                  std::deque<Step> trace_;
+                  std::map<const void*, std::size_t> objects_;
+            };
+
+            /**
+             * @brief Runs a test body under many schedules: first every one
+             *        within --preemptions of the default schedule (up to
+             *        --schedules of them), then PCT schedules for what is
+             *        left, stopping at the first that fails. --replay runs
+             *        the one schedule it names.
+             */
+            inline void Explore(const TestFunction& body)
+            {
+                  const Options& options = GetOptions();
+                  TestContext* context = CurrentContext();
+
+                  if (!options.replay.empty()) {
+                        ReplayStrategy replay(options.replay);
+                        Scheduler scheduler(replay, context);
+                        scheduler.Run(body);
+                        if (Failed()) {
+                              Out() << "      [+] Last steps of schedule " << options.replay << ":" << std::endl << scheduler.Trace();
+                        }
+                        else {
+                              Out() << "      [√] PASSED schedule " << options.replay << std::endl << std::endl;
+                        }
+                        return;
+                  }
+
+                  const std::uint64_t seed = options.seed != 0 ? options.seed : FreshSeed();
+                  BoundedSearch search(options.preemptions);
+                  bool searching = true;
+                  std::size_t searched = 0;
+                  std::size_t expected_steps = 0;
+
+                  if (context) {
+                        context->quiet = true;
+                  }
+                  std::size_t schedule = 0;
+                  bool out_of_time = false;
+                  for (; schedule < options.schedules; schedule++) {
+                        if (context && std::chrono::steady_clock::now() >= context->deadline) {
+                              out_of_time = true;
+                              break;
+                        }
+
+                        std::unique_ptr<Strategy> pct;
+                        if (searching) {
+                              search.Begin();
+                        }
+                        else {
+                              pct = std::make_unique<PriorityStrategy>(MixSeed(seed, schedule), std::max<std::size_t>(expected_steps, 16));
+                        }
+                        Scheduler scheduler(searching ? static_cast<Strategy&>(search) : *pct, context);
+                        scheduler.Run(body);
+                        expected_steps = std::max(expected_steps, scheduler.Steps());
+
+                        if (Failed()) {
+                              if (context) {
+                                    context->quiet = false;
+                                    std::lock_guard<std::mutex> lock(context->mutex);
+                                    context->message += " (schedule " + std::to_string(schedule + 1) + ", "
+                                          + std::to_string(scheduler.Preemptions()) + " preemptions, --replay=" + scheduler.Schedule() + ")";
+                              }
+                              Out() << "      [+] Failed under schedule " << schedule + 1 << " ("
+                                    << (searching ? "bounded search" : "PCT, seed " + std::to_string(seed)) << "), rerun it with --replay="
+                                    << scheduler.Schedule() << std::endl;
+                              Out() << "      [+] Last steps:" << std::endl << scheduler.Trace();
+                              return;
+                        }
+
+                        if (searching) {
+                              searched++;
+                              searching = search.Advance();
+                        }
+                  }
+                  if (context) {
+                        context->quiet = false;
+                  }
+
+                  std::ostringstream summary;
+                  summary << schedule << " schedules: " << searched << (searching ? " of those" : "")
+                          << " within " << options.preemptions << " preemptions, " << schedule - searched << " PCT";
+                  if (out_of_time) {
+                        Out() << "      [!] WARNING: Ran out of time after " << summary.str() << std::endl;
+                  }
+                  else {
+                        Out() << "      [√] PASSED " << summary.str() << std::endl << std::endl;
+                  }
+            }
+      }
+
+      /**
+       * @brief Drop-in stand-ins for std::atomic, std::mutex and std::thread.
+       *        Outside of an INTERLEAVINGS test they are thin wrappers over
+       *        the real thing, so code under test can use them through a
+       *        typedef. Inside one, every operation on them is a point where
+       *        the explored schedule may switch threads.
+       */
+      namespace sim
+      {
+            /** Hints that the calling thread waits for another, e.g. in a spin loop */
+            inline void Yield()
+            {
+                  if (detail::Scheduler* scheduler = detail::Scheduler::Current()) {
+                        scheduler->Point(detail::SimOp::Yield, nullptr);
+                  }
+                  else {
+                        std::this_thread::yield();
+                  }
+            }
+
+            /**
+             * @brief std::atomic stand-in. Inside a simulation it keeps the
+             *        last stores made to it, and loads may read any of them
+             *        their memory order and the happens-before relation
+             *        allow (seq_cst loads read the latest).
+             */
+            template<typename T>
+            class Atomic
+            {
+            public:
+                  Atomic() : real_(T()) {}
+                  Atomic(T value) : real_(value) {}
+
+                  Atomic(const Atomic&) = delete;
+                  Atomic& operator=(const Atomic&) = delete;
+
+                  T load(std::memory_order order = std::memory_order_seq_cst) const
+                  {
+                        detail::Scheduler* scheduler = Attach();
+                        if (!scheduler) {
+                              return real_.load(order);
+                        }
+                        scheduler->Point(detail::SimOp::Load, this);
+                        detail::Scheduler::Thread& me = scheduler->Me();
+
+                        // Coherence: never older than what this thread saw, or than a store that happens before the load
+                        std::size_t oldest = seen_[me.id];
+                        for (std::size_t i = history_.size(); i-- > 0;) {
+                              if (me.clock.Get(history_[i].writer) >= history_[i].stamp) {
+                                    oldest = std::max(oldest, history_[i].sequence);
+                                    break;
+                              }
+                        }
+                        if (order == std::memory_order_seq_cst) {
+                              oldest = history_.back().sequence;
+                        }
+                        std::size_t count = 0;
+                        while (count < history_.size() && history_[history_.size() - 1 - count].sequence >= oldest) {
+                              count++;
+                        }
+
+                        const Store& store = history_[history_.size() - 1 - scheduler->ChooseValue(count)];
+                        Observe(me, store, order);
+                        return store.value;
+                  }
+
+                  void store(T value, std::memory_order order = std::memory_order_seq_cst)
+                  {
+                        detail::Scheduler* scheduler = Attach();
+                        real_.store(value, order);
+                        if (!scheduler) {
+                              return;
+                        }
+                        scheduler->Point(detail::SimOp::Store, this);
+                        detail::Scheduler::Thread& me = scheduler->Me();
+                        Append(me, value, detail::IsRelease(order), detail::VectorClock());
+                  }
+
+                  T exchange(T value, std::memory_order order = std::memory_order_seq_cst)
+                  {
+                        return Modify([value](const T&) { return value; }, order);
+                  }
+
+                  T fetch_add(T delta, std::memory_order order = std::memory_order_seq_cst)
+                  {
+                        return Modify([delta](const T& value) { return static_cast<T>(value + delta); }, order);
+                  }
+
+                  T fetch_sub(T delta, std::memory_order order = std::memory_order_seq_cst)
+                  {
+                        return Modify([delta](const T& value) { return static_cast<T>(value - delta); }, order);
+                  }
+
+                  bool compare_exchange_strong(T& expected, T desired, std::memory_order success, std::memory_order failure)
+                  {
+                        detail::Scheduler* scheduler = Attach();
+                        if (!scheduler) {
+                              return real_.compare_exchange_strong(expected, desired, success, failure);
+                        }
+                        scheduler->Point(detail::SimOp::Rmw, this);
+                        detail::Scheduler::Thread& me = scheduler->Me();
+                        const Store latest = history_.back();
+                        if (!(latest.value == expected)) {
+                              expected = latest.value;
+                              Observe(me, latest, failure);
+                              return false;
+                        }
+                        Observe(me, latest, success);
+                        real_.store(desired);
+                        Append(me, desired, detail::IsRelease(success), latest.release ? latest.clock : detail::VectorClock());
+                        return true;
+                  }
+
+                  bool compare_exchange_strong(T& expected, T desired, std::memory_order order = std::memory_order_seq_cst)
+                  {
+                        return compare_exchange_strong(expected, desired, order, FailureOrder(order));
+                  }
+
+                  /** Never fails spuriously in a simulation */
+                  bool compare_exchange_weak(T& expected, T desired, std::memory_order success, std::memory_order failure)
+                  {
+                        return compare_exchange_strong(expected, desired, success, failure);
+                  }
+
+                  bool compare_exchange_weak(T& expected, T desired, std::memory_order order = std::memory_order_seq_cst)
+                  {
+                        return compare_exchange_strong(expected, desired, order, FailureOrder(order));
+                  }
+
+                  operator T() const { return load(); }
+                  T operator=(T value) { store(value); return value; }
+                  T operator++() { return fetch_add(1) + 1; }
+                  T operator++(int) { return fetch_add(1); }
+                  T operator--() { return fetch_sub(1) - 1; }
+                  T operator--(int) { return fetch_sub(1); }
+
+            private:
+                  struct Store
+                  {
+                        T value;
+                        std::size_t writer;
+                        std::size_t stamp;
+                        std::size_t sequence;
+                        bool release;
+                        detail::VectorClock clock;
+                  };
+
+                  static const std::size_t kHistory = 8;
+
+                  static std::memory_order FailureOrder(std::memory_order order)
+                  {
+                        return order == std::memory_order_acq_rel ? std::memory_order_acquire
+                               : order == std::memory_order_release ? std::memory_order_relaxed : order;
+                  }
+
+                  /** Starts a fresh history the first time a schedule uses the atomic */
+                  detail::Scheduler* Attach() const
+                  {
+                        detail::Scheduler* scheduler = detail::Scheduler::Current();
+                        if (scheduler && scheduler->Generation() != generation_) {
+                              generation_ = scheduler->Generation();
+                              history_.assign(1, Store{ real_.load(), 0, 0, 0, false, detail::VectorClock() });
+                              seen_.clear();
+                              next_sequence_ = 1;
+                        }
+                        return scheduler;
+                  }
+
+                  void Observe(detail::Scheduler::Thread& me, const Store& store, std::memory_order order) const
+                  {
+                        std::size_t& seen = seen_[me.id];
+                        seen = std::max(seen, store.sequence);
+                        if (store.release && detail::IsAcquire(order)) {
+                              me.clock.Join(store.clock);
+                        }
+                  }
+
+                  void Append(detail::Scheduler::Thread& me, T value, bool release, detail::VectorClock carried)
+                  {
+                        Store store{ value, me.id, me.clock.Get(me.id), next_sequence_++, release || !carried.times.empty(), std::move(carried) };
+                        if (release) {
+                              store.clock.Join(me.clock);
+                        }
+                        me.clock.Tick(me.id);
+                        seen_[me.id] = store.sequence;
+                        history_.push_back(std::move(store));
+                        if (history_.size() > kHistory) {
+                              history_.erase(history_.begin());
+                        }
+                  }
+
+                  template<typename Function>
+                  T Modify(Function function, std::memory_order order)
+                  {
+                        detail::Scheduler* scheduler = Attach();
+                        if (!scheduler) {
+                              T value = real_.load(std::memory_order_relaxed);
+                              while (!real_.compare_exchange_weak(value, function(value), order, std::memory_order_relaxed)) {
+                              }
+                              return value;
+                        }
+                        scheduler->Point(detail::SimOp::Rmw, this);
+                        detail::Scheduler::Thread& me = scheduler->Me();
+                        const Store latest = history_.back();
+                        Observe(me, latest, order);
+                        const T value = function(latest.value);
+                        real_.store(value);
+                        // Read-modify-writes continue the release sequence of the store they read
+                        Append(me, value, detail::IsRelease(order), latest.release ? latest.clock : detail::VectorClock());
+                        return latest.value;
+                  }
+
+                  mutable std::atomic<T> real_;
+                  mutable std::size_t generation_ = 0;
+                  mutable std::vector<Store> history_;
+                  mutable std::map<std::size_t, std::size_t> seen_;
+                  mutable std::size_t next_sequence_ = 1;
+            };
+
+            /** std::mutex stand-in, works with std::lock_guard and std::unique_lock */
+            class Mutex
+            {
+            public:
+                  Mutex() = default;
+                  Mutex(const Mutex&) = delete;
+                  Mutex& operator=(const Mutex&) = delete;
+
+                  void lock()
+                  {
+                        if (detail::Scheduler* scheduler = Attach()) {
+                              scheduler->Lock(state_, true);
+                        }
+                        else {
+                              real_.lock();
+                        }
+                  }
+
+                  bool try_lock()
+                  {
+                        if (detail::Scheduler* scheduler = Attach()) {
+                              return scheduler->Lock(state_, false);
+                        }
+                        return real_.try_lock();
+                  }
+
+                  void unlock()
+                  {
+                        if (detail::Scheduler* scheduler = Attach()) {
+                              scheduler->Unlock(state_);
+                        }
+                        else {
+                              real_.unlock();
+                        }
+                  }
+
+            private:
+                  detail::Scheduler* Attach()
+                  {
+                        detail::Scheduler* scheduler = detail::Scheduler::Current();
+                        if (scheduler && scheduler->Generation() != generation_) {
+                              generation_ = scheduler->Generation();
+                              state_ = detail::Scheduler::MutexState();
+                        }
+                        return scheduler;
+                  }
+
+                  std::mutex real_;
+                  std::size_t generation_ = 0;
+                  detail::Scheduler::MutexState state_;
+            };
+
+            /** std::thread stand-in, joined on destruction if still joinable */
+            class Thread
+            {
+            public:
+                  template<typename Function>
+                  explicit Thread(Function function)
+                  {
+                        if (detail::Scheduler* scheduler = detail::Scheduler::Current()) {
+                              scheduler_ = scheduler;
+                              id_ = scheduler->Spawn(TestFunction(function));
+                        }
+                        else {
+                              real_ = std::thread(function);
+                        }
+                  }
+
+                  Thread(const Thread&) = delete;
+                  Thread& operator=(const Thread&) = delete;
+
+                  ~Thread()
+                  {
+                        if (joinable() && scheduler_) {
+                              joined_ = true;
+                              scheduler_->Join(id_, false);
+                        }
+                        else if (joinable()) {
+                              real_.join();
+                        }
+                  }
+
+                  bool joinable() const { return scheduler_ ? !joined_ : real_.joinable(); }
+
+                  void join()
+                  {
+                        if (scheduler_) {
+                              joined_ = true;
+                              scheduler_->Join(id_, true);
+                        }
+                        else {
+                              real_.join();
+                        }
+                  }
+
+            private:
+                  detail::Scheduler* scheduler_ = nullptr;
+                  std::size_t id_ = 0;
+                  bool joined_ = false;
+                  std::thread real_;
+            };
+
+            /**
+             * @brief A plain (non-atomic) variable shared between threads.
+             *        Inside a simulation, accesses that are not ordered by
+             *        happens-before (through atomics, mutexes, spawn and
+             *        join) fail the test as data races.
+             */
+            template<typename T>
+            class Var
+            {
+            public:
+                  Var() : value_() {}
+                  Var(T value) : value_(value) {}
+
+                  T Read() const
+                  {
+                        Check(false);
+                        return value_;
+                  }
+
+                  void Write(T value)
+                  {
+                        Check(true);
+                        value_ = value;
+                  }
+
+                  operator T() const { return Read(); }
+                  Var& operator=(T value) { Write(value); return *this; }
+
+            private:
+                  void Check(bool write) const
+                  {
+                        detail::Scheduler* scheduler = detail::Scheduler::Current();
+                        if (!scheduler || scheduler->Abandoning()) {
+                              return;
+                        }
+                        if (scheduler->Generation() != generation_) {
+                              generation_ = scheduler->Generation();
+                              writer_ = 0;
+                              write_stamp_ = 0;
+                              reads_ = detail::VectorClock();
+                        }
+
+                        detail::Scheduler::Thread& me = scheduler->Me();
+                        std::string race;
+                        if (writer_ != me.id && me.clock.Get(writer_) < write_stamp_) {
+                              race = "thread " + std::to_string(writer_) + " wrote";
+                        }
+                        for (std::size_t thread = 0; write && race.empty() && thread < reads_.times.size(); thread++) {
+                              if (thread != me.id && me.clock.Get(thread) < reads_.times[thread]) {
+                                    race = "thread " + std::to_string(thread) + " read";
+                              }
+                        }
+                        if (!race.empty()) {
+                              scheduler->Abandon("Data race on sim::Var #" + std::to_string(scheduler->ObjectId(this)) + ": thread "
+                                    + std::to_string(me.id) + (write ? " writes" : " reads") + " it while " + race + " it unsynchronised");
+                              scheduler->Unwind();
+                              return;
+                        }
+
+                        const std::size_t stamp = me.clock.Get(me.id);
+                        if (write) {
+                              writer_ = me.id;
+                              write_stamp_ = stamp;
+                        }
+                        else {
+                              if (reads_.times.size() <= me.id) {
+                                    reads_.times.resize(me.id + 1, 0);
+                              }
+                              reads_.times[me.id] = stamp;
+                        }
+                  }
+
+                  T value_;
+                  mutable std::size_t generation_ = 0;
+                  mutable std::size_t writer_ = 0;
+                  mutable std::size_t write_stamp_ = 0;
+                  mutable detail::VectorClock reads_;
+            };
+      }
+
+      /**
+       * @brief Defines a test exploring the thread interleavings of a body
+       *        that uses the unipp::sim primitives.
+       *
+       *        INTERLEAVINGS("Queue", "Push and pop race", []() {
+       *              Queue<unipp::sim::Atomic> queue;
+       *              unipp::sim::Thread producer([&]() { queue.Push(1); });
+       *              unipp::sim::Thread consumer([&]() { ... });
+       *        })
+       */
+      inline UnitTest Interleavings(std::string name, std::string description, TestFunction body)
+      {
+            return UnitTest(name, description, [body]() { detail::Explore(body); });
+      }
+
+#if defined(UNIPP_HAS_DLOPEN)
+      /** Test modules and watch mode */
+
+      namespace detail
+      {
+            /** What UNIPP_MODULE exports, the registry entry point of a test module */
+            typedef int (*ModuleMain)(int argc, char** argv);
+
+            inline const char* const kModuleSymbol = "unipp_module_main";
+
+            /**
+             * @brief Loads a test module in a forked child and runs its tests
+             *        there, with the given options. The child gets a fresh
+             *        copy of the module every time, so a rebuilt module is
+             *        never shadowed by one dlclose could not unload, and a
+             *        crashing module cannot take the watcher down with it.
+             *        With a channel, the child publishes its results to it,
+             *        and they are handed to record while it runs.
+             */
+            inline bool RunModule(const std::string& path, const std::vector<std::string>& options,
+                                  ResultChannel* channel, const std::function<void(TestResult)>& record)
+            {
+                  std::cout << "[MODULE] " << path << std::endl;
+                  std::cout.flush();
+                  const pid_t child = fork();
+                  if (child < 0) {
+                        std::cerr << "[!] Could not fork to run " << path << ": " << std::strerror(errno) << std::endl;
+                        return false;
+                  }
+                  if (child == 0) {
+                        void* module = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+                        if (!module) {
+                              std::cerr << "[!] Could not load " << path << ": " << dlerror() << std::endl;
+                              _exit(1);
+                        }
+                        const ModuleMain main = reinterpret_cast<ModuleMain>(dlsym(module, kModuleSymbol));
+                        if (!main) {
+                              std::cerr << "[!] " << path << " has no " << kModuleSymbol << ", define its tests with UNIPP_MODULE" << std::endl;
+                              _exit(1);
+                        }
+                        std::vector<std::string> arguments{ path };
+                        arguments.insert(arguments.end(), options.begin(), options.end());
+                        std::vector<char*> argv;
+                        for (auto& argument : arguments) {
+                              argv.push_back(&argument[0]);
+                        }
+                        argv.push_back(nullptr);
+                        const int code = main(static_cast<int>(arguments.size()), argv.data());
+                        std::cout.flush();
+                        _exit(code);
+                  }
+
+                  int status = 0;
+                  if (channel) {
+                        // The child waits for room once the ring is full, so it is drained while the child runs
+                        for (;;) {
+                              channel->Drain(record);
+                              const pid_t done = waitpid(child, &status, WNOHANG);
+                              if (done == child || (done < 0 && errno != EINTR)) {
+                                    break;
+                              }
+                              std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        }
+                        channel->Drain(record);
+                  }
+                  else {
+                        while (waitpid(child, &status, 0) < 0 && errno == EINTR) {
+                        }
+                  }
+                  if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+                        return true;
+                  }
+                  if (!WIFEXITED(status)) {
+                        std::cout << "[!] " << path << " " << DescribeStatus(status) << std::endl;
+                        if (channel) {
+                              TestResult crash;
+                              crash.suite = path;
+                              crash.name = "[crash]";
+                              crash.status = TestStatus::Failed;
+                              crash.message = "The module " + DescribeStatus(status);
+                              record(crash);
+                        }
+                  }
+                  return false;
+            }
+
+            /** Modification stamp of a file, 0 if it is missing */
+            inline std::int64_t ModuleStamp(const std::string& path)
+            {
+                  struct stat info;
+                  if (stat(path.c_str(), &info) != 0) {
+                        return 0;
+                  }
+#if defined(__APPLE__)
+                  return std::int64_t(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+                  return std::int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#endif // __APPLE__
+            }
+
+            /**
+             * @brief Watches modules for rebuilds. Linux waits on inotify
+             *        events for the modules' directories (linkers often write
+             *        a new file and rename it over the old one), elsewhere the
+             *        modules are polled. It is created before the modules
+             *        first run, so that rebuilds during a run are caught too.
+             */
+            class RebuildWatcher
+            {
+            public:
+                  explicit RebuildWatcher(const std::vector<std::string>& modules) : modules_(modules)
+                  {
+                        for (const auto& module : modules_) {
+                              stamps_.push_back(ModuleStamp(module));
+                        }
+#if defined(UNIPP_HAS_INOTIFY)
+                        watcher_ = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+                        if (watcher_ >= 0) {
+                              for (const auto& module : modules_) {
+                                    const std::string directory = std::filesystem::path(module).parent_path().string();
+                                    inotify_add_watch(watcher_, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+                              }
+                        }
+#endif // UNIPP_HAS_INOTIFY
+                  }
+
+                  ~RebuildWatcher()
+                  {
+#if defined(UNIPP_HAS_INOTIFY)
+                        if (watcher_ >= 0) {
+                              close(watcher_);
+                        }
+#endif // UNIPP_HAS_INOTIFY
+                  }
+
+                  RebuildWatcher(const RebuildWatcher&) = delete;
+                  RebuildWatcher& operator=(const RebuildWatcher&) = delete;
+
+                  /**
+                   * @brief Blocks until at least one module was rebuilt since
+                   *        the last call (or since the watcher was created),
+                   *        and returns which. A module only counts as rebuilt
+                   *        once it has been left alone for a moment, so a half
+                   *        written file is never loaded.
+                   */
+                  std::vector<std::size_t> Wait()
+                  {
+                        const auto settle = std::chrono::milliseconds(250);
+                        std::vector<std::size_t> changed;
+                        for (;;) {
+                              // Anything that moved restarts the wait, until the modules settle
+                              bool moved = false;
+                              for (std::size_t i = 0; i < modules_.size(); i++) {
+                                    const std::int64_t stamp = ModuleStamp(modules_[i]);
+                                    if (stamp != 0 && stamp != stamps_[i]) {
+                                          stamps_[i] = stamp;
+                                          moved = true;
+                                          if (std::find(changed.begin(), changed.end(), i) == changed.end()) {
+                                                changed.push_back(i);
+                                          }
+                                    }
+                              }
+                              if (!changed.empty() && !moved) {
+                                    break;
+                              }
+
+#if defined(UNIPP_HAS_INOTIFY)
+                              if (watcher_ >= 0) {
+                                    pollfd events{ watcher_, POLLIN, 0 };
+                                    if (poll(&events, 1, changed.empty() ? -1 : static_cast<int>(settle.count())) > 0) {
+                                          alignas(inotify_event) char buffer[4096];
+                                          while (read(watcher_, buffer, sizeof(buffer)) > 0 || errno == EINTR) {
+                                          }
+                                    }
+                                    continue;
+                              }
+#endif // UNIPP_HAS_INOTIFY
+                              std::this_thread::sleep_for(settle);
+                        }
+                        std::sort(changed.begin(), changed.end());
+                        return changed;
+                  }
+
+            private:
+                  std::vector<std::string> modules_;
+                  std::vector<std::int64_t> stamps_;
+#if defined(UNIPP_HAS_INOTIFY)
+                  int watcher_ = -1;
+#endif // UNIPP_HAS_INOTIFY
+            };
+      }
+
+      /**
+       * @brief Runner for test modules: shared objects whose tests are
+       *        defined with UNIPP_MODULE. Arguments that are not options
+       *        are module paths, options are passed on to every module.
+       *        The modules publish their results to a shared result
+       *        channel, so the runner writes --junit and --tap reports
+       *        and a summary covering all of them.
+       *        With --watch, it then waits for modules to be rebuilt and
+       *        reruns the tests of just those, until interrupted.
+       *
+       *        int main(int argc, char** argv)
+       *        {
+       *              return RUN_MODULES(argc, argv);
+       *        }
+       *
+       *        ./runner --watch --jobs=4 build/math_tests.so build/io_tests.so
+       */
+      inline int RunModules(int argc, char** argv)
+      {
+            std::vector<std::string> modules;
+            std::vector<std::string> options;
+            for (int i = 1; i < argc; i++) {
+                  const std::string argument = argv[i];
+                  const std::size_t equals = argument.find('=');
+                  const std::string name = argument.substr(0, equals);
+                  if (name == "--watch" || name == "--junit" || name == "--tap") {
+                        detail::ParseOption(GetOptions(), name.substr(2), equals == std::string::npos ? "" : argument.substr(equals + 1));
+                  }
+                  else {
+                        (argument.compare(0, 2, "--") == 0 ? options : modules).push_back(argument);
+                  }
+            }
+            if (modules.empty()) {
+                  std::cerr << "[!] No test modules given" << std::endl;
+                  return 1;
+            }
+
+            std::unique_ptr<detail::ResultChannel> channel;
+            try {
+                  channel = std::make_unique<detail::ResultChannel>();
+                  options.push_back("--results=" + std::to_string(channel->Descriptor()));
+            }
+            catch (const std::exception& e) {
+                  std::cerr << "[!] No summary of the modules, " << e.what() << std::endl;
+            }
+
+            // Runs some of the modules, reporting on all of their tests at once
+            const auto run = [&](const std::vector<std::size_t>& indices) {
+                  std::size_t total = 0;
+                  std::size_t counts[5] = { 0, 0, 0, 0, 0 };
+                  std::vector<std::unique_ptr<detail::Reporter>> reporters;
+                  if (!GetOptions().junit.empty()) {
+                        reporters.push_back(std::make_unique<detail::JUnitReporter>(GetOptions().junit));
+                  }
+                  if (!GetOptions().tap.empty()) {
+                        reporters.push_back(std::make_unique<detail::TapReporter>(GetOptions().tap));
+                  }
+                  for (auto& reporter : reporters) {
+                        reporter->Begin();
+                  }
+
+                  bool passed = true;
+                  for (std::size_t index : indices) {
+                        passed &= detail::RunModule(modules[index], options, channel.get(), [&](const TestResult& result) {
+                              total++;
+                              counts[static_cast<int>(result.status)]++;
+                              for (auto& reporter : reporters) {
+                                    reporter->Report(result);
+                              }
+                        });
+                  }
+
+                  for (auto& reporter : reporters) {
+                        reporter->End();
+                  }
+                  if (channel) {
+                        std::cout << "[MODULES] " << total << " tests in " << indices.size() << " modules: "
+                                  << counts[0] << " passed, " << counts[1] << " failed, "
+                                  << counts[2] << " timed out, " << counts[3] << " cached, " << counts[4] << " flaky" << std::endl;
+                  }
+                  return passed;
+            };
+
+            std::unique_ptr<detail::RebuildWatcher> watcher;
+            if (GetOptions().watch) {
+                  watcher = std::make_unique<detail::RebuildWatcher>(modules);
+            }
+            std::vector<std::size_t> all;
+            for (std::size_t i = 0; i < modules.size(); i++) {
+                  all.push_back(i);
+            }
+            const bool passed = run(all);
+
+            while (watcher) {
+                  std::cout << "[WATCH] Waiting for changes to " << modules.size() << " modules..." << std::endl;
+                  run(watcher->Wait());
+            }
+            return passed ? 0 : 1;
+      }
+#endif // UNIPP_HAS_DLOPEN
+}
+
+
+/**
+ * Coverage callbacks for fuzzing. Define UNIPP_FUZZ_COVERAGE in one source
+ * file of the test binary and build it with -fsanitize-coverage=trace-pc-guard
+ * (Clang) or -fsanitize-coverage=trace-pc (GCC) to guide --fuzz with edge coverage.
+ */
+#if defined(UNIPP_FUZZ_COVERAGE)
+extern "C" UNIPP_NO_COVERAGE void __sanitizer_cov_trace_pc_guard_init(std::uint32_t* start, std::uint32_t* stop)
+{
+      unipp::detail::Coverage& coverage = unipp::detail::coverage;
+      if (start == stop || *start) {
+            return;
+      }
+      for (std::uint32_t* guard = start; guard < stop; guard++) {
+            *guard = ++coverage.guards;
+      }
+}
+
+extern "C" UNIPP_NO_COVERAGE void __sanitizer_cov_trace_pc_guard(std::uint32_t* guard)
+{
+      unipp::detail::Coverage& coverage = unipp::detail::coverage;
+      if (coverage.tracing) {
+            std::uint8_t& counter = coverage.counters[*guard % unipp::detail::kCoverageMapSize];
+            counter += counter != 0xFF;
+      }
+}
+
+extern "C" UNIPP_NO_COVERAGE void __sanitizer_cov_trace_pc()
+{
+      unipp::detail::Coverage& coverage = unipp::detail::coverage;
+      if (coverage.tracing) {
+            const std::uintptr_t pc = reinterpret_cast<std::uintptr_t>(__builtin_return_address(0));
+            std::uint8_t& counter = coverage.counters[(pc ^ (pc >> 16)) % unipp::detail::kCoverageMapSize];
+            counter += counter != 0xFF;
+      }
+}
+#endif // UNIPP_FUZZ_COVERAGE
+
+
+/**
+ * Replacements of the global operator new and delete that feed
+ * UNIPP_ASSERT_NO_ALLOC. Define UNIPP_ALLOC_HOOKS before including unipp.hpp
+ * in exactly one source file of the test binary.
+ */
+#if defined(UNIPP_ALLOC_HOOKS)
+namespace unipp
+{
+      namespace detail
+      {
+            const bool kAllocationHooksInstalled = (allocation_hooks.store(true), true);
+
+            inline void* HookedAllocate(std::size_t size, std::size_t alignment, bool nothrow)
+            {
+                  NoteAllocation(size, false);
+                  size = size ? size : 1;
+                  for (;;) {
+                        void* memory = nullptr;
+#if defined(_WIN32)
+                        memory = alignment ? _aligned_malloc(size, alignment) : std::malloc(size);
+#else
+                        if (alignment == 0) {
+                              memory = std::malloc(size);
+                        }
+                        else if (posix_memalign(&memory, std::max(alignment, sizeof(void*)), size) != 0) {
+                              memory = nullptr;
+                        }
+#endif // _WIN32
+                        if (memory) {
+                              return memory;
+                        }
+                        std::new_handler handler = std::get_new_handler();
+                        if (!handler) {
+                              if (nothrow) {
+                                    return nullptr;
+                              }
+                              throw std::bad_alloc();
+                        }
+                        handler();
+                  }
+            }
+
+            inline void HookedFree(void* memory, bool aligned)
+            {
+                  if (!memory) {
+                        return;
+                  }
+                  NoteAllocation(0, true);
+#if defined(_WIN32)
+                  aligned ? _aligned_free(memory) : std::free(memory);
+#else
+                  (void)aligned;
+                  std::free(memory);
+#endif // _WIN32
+            }
+      }
+}
+
+void* operator new(std::size_t size) { return unipp::detail::HookedAllocate(size, 0, false); }
+void* operator new[](std::size_t size) { return unipp::detail::HookedAllocate(size, 0, false); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return unipp::detail::HookedAllocate(size, 0, true); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return unipp::detail::HookedAllocate(size, 0, true); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return unipp::detail::HookedAllocate(size, std::size_t(alignment), false); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return unipp::detail::HookedAllocate(size, std::size_t(alignment), false); }
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return unipp::detail::HookedAllocate(size, std::size_t(alignment), true); }
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return unipp::detail::HookedAllocate(size, std::size_t(alignment), true); }
+
+void operator delete(void* memory) noexcept { unipp::detail::HookedFree(memory, false); }
+void operator delete[](void* memory) noexcept { unipp::detail::HookedFree(memory, false); }
+void operator delete(void* memory, std::size_t) noexcept { unipp::detail::HookedFree(memory, false); }
+void operator delete[](void* memory, std::size_t) noexcept { unipp::detail::HookedFree(memory, false); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { unipp::detail::HookedFree(memory, false); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { unipp::detail::HookedFree(memory, false); }
+void operator delete(void* memory, std::align_val_t) noexcept { unipp::detail::HookedFree(memory, true); }
+void operator delete[](void* memory, std::align_val_t) noexcept { unipp::detail::HookedFree(memory, true); }
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept { unipp::detail::HookedFree(memory, true); }
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept { unipp::detail::HookedFree(memory, true); }
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept { unipp::detail::HookedFree(memory, true); }
+void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept { unipp::detail::HookedFree(memory, true); }
+#endif // UNIPP_ALLOC_HOOKS
+
+#endif // UNIPP_LIGHT
+
 #endif // UNIPP_TEST_FRAMEWORK_HPP
 
 // MIT License